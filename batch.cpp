@@ -0,0 +1,101 @@
+//
+// Created by schrodinger on 2/18/21.
+//
+
+#include "grammar/batch.h"
+
+parser::ParsePool::ParsePool(size_t workers) {
+    workers = std::max<size_t>(workers, 1);
+    for (size_t i = 0; i < workers; ++i) {
+        sessions.push_back(std::make_shared<ParseSession>());
+    }
+    threads.reserve(workers - 1);
+    for (size_t worker = 1; worker < workers; ++worker) {
+        threads.emplace_back([this, worker] { work(worker); });
+    }
+}
+
+parser::ParsePool::~ParsePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void parser::ParsePool::work(size_t worker) {
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        drain(worker);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--running == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void parser::ParsePool::drain(size_t worker) {
+    for (size_t index; (index = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+        task(context, worker, index);
+    }
+}
+
+void parser::ParsePool::dispatch(size_t total, Task job, void *state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = job;
+        context = state;
+        count = total;
+        next.store(0, std::memory_order_relaxed);
+        running = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return running == 0; });
+}
+
+double *parser::ParsePool::latency_buffer(size_t total) {
+    if (latencies.size() < total) {
+        latencies.resize(total);
+    }
+    return latencies.data();
+}
+
+parser::BatchStats parser::ParsePool::summarize(size_t total, size_t bytes, size_t failures, double seconds) {
+    BatchStats stats;
+    stats.documents = total;
+    stats.bytes = bytes;
+    stats.failures = failures;
+    stats.seconds = seconds;
+    if (seconds > 0) {
+        stats.documents_per_second = static_cast<double>(total) / seconds;
+        stats.megabytes_per_second = static_cast<double>(bytes) / 1e6 / seconds;
+    }
+    if (!total) {
+        return stats;
+    }
+    auto first = latencies.begin(), last = latencies.begin() + static_cast<ptrdiff_t>(total);
+    auto percentile = [&](double fraction) {
+        auto nth = first + static_cast<ptrdiff_t>(fraction * static_cast<double>(total - 1));
+        std::nth_element(first, nth, last);
+        return *nth;
+    };
+    stats.p50_us = percentile(0.5);
+    stats.p90_us = percentile(0.9);
+    stats.p99_us = percentile(0.99);
+    stats.max_us = *std::max_element(first, last);
+    return stats;
+}
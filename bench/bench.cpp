@@ -0,0 +1,657 @@
+//
+// Created by schrodinger on 2/10/21.
+//
+
+#include "frontend.h"
+#include "micro.h"
+#include "grammar/recognize.h"
+#include "grammar/select.h"
+#include "grammar/flat.h"
+#include "grammar/events.h"
+#include "grammar/batch.h"
+#include "grammar/parallel.h"
+#include "grammar/iterative.h"
+#include "grammar/loader.h"
+#include "grammar/cache.h"
+#include "grammar/dump.h"
+#include "grammar/stream.h"
+#include "persistent_sym_table.h"
+#include "micro_vm.h"
+#include "generator.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+    std::atomic<size_t> allocation_count{0};
+    std::atomic<size_t> allocation_bytes{0};
+
+    using Clock = std::chrono::steady_clock;
+
+    /*!
+     * The micro grammar as text, for the grammar loader.
+     */
+    const char *micro_grammar = R"(
+        Toplevel <- ^ S MicroBegin S Stmt+ S MicroEnd S $ S
+        Op <~ '+' / '-'
+        MicroBegin <- 'begin'
+        MicroEnd <- 'end'
+        Read <- 'read'
+        Write <- 'write'
+        Alpha <~ [a-zA-Z]
+        Digit <~ [0-9]
+        Integer <- Digit+
+        ASCII <~ Alpha / Digit / '_'
+        Identity <- (Alpha / '_') ASCII*
+        AssignmentOp <~ ':' '='
+        Assignment <- Identity S AssignmentOp S Expr S
+        IdentityList <- Identity S (',' S IdentityList S)* S
+        ExprList <- Expr S (',' S ExprList S)* S
+        ReadStmt <- Read S '(' S IdentityList S ')' S
+        WriteStmt <- Write S '(' S ExprList S ')' S
+        Primary <- '(' S Expr S ')' S / Identity / Integer
+        Expr <- Primary S (Op S Primary S)* S
+        Stmt <= (ReadStmt / WriteStmt / Assignment) S ';' S
+        S <- [ \t\n\r\v]*
+    )";
+
+    double elapsed(Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    }
+
+    /*!
+     * @return peak resident set size of the process so far, in kilobytes.
+     */
+    size_t peak_rss_kb() {
+        rusage usage{};
+        ::getrusage(RUSAGE_SELF, &usage);
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    size_t count_nodes(parser::TreePtr tree) {
+        size_t count = 1;
+        for (auto i : tree->subtrees()) {
+            count += count_nodes(i);
+        }
+        return count;
+    }
+
+    void collect_identifiers(parser::TreePtr tree, std::vector<std::string> &names) {
+        if (tree->rule == parser::rule_id<grammar::Identity>()) {
+            names.emplace_back(tree->parsed_region);
+        }
+        for (auto i : tree->subtrees()) {
+            collect_identifiers(i, names);
+        }
+    }
+
+    bool parse_options(int argc, char **argv, bench::GeneratorOptions &options, size_t &runs) {
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string flag = argv[i];
+            char *value = argv[i + 1];
+            if (flag == "--statements") {
+                options.statements = std::strtoull(value, nullptr, 10);
+            } else if (flag == "--depth") {
+                options.depth = std::strtoull(value, nullptr, 10);
+            } else if (flag == "--identifier") {
+                options.identifier = std::strtoull(value, nullptr, 10);
+            } else if (flag == "--whitespace") {
+                options.whitespace = std::strtod(value, nullptr);
+            } else if (flag == "--seed") {
+                options.seed = std::strtoull(value, nullptr, 10);
+            } else if (flag == "--runs") {
+                runs = std::max<size_t>(std::strtoull(value, nullptr, 10), 1);
+            } else {
+                return false;
+            }
+        }
+        return argc % 2 == 1;
+    }
+
+    struct StatementCounter {
+        size_t statements = 0;
+
+        void enter(std::type_index, size_t) {
+            statements++;
+        }
+
+        void exit(std::type_index, std::string_view) {}
+    };
+}
+
+namespace {
+    /*!
+     * Every replaced allocation function goes through this pair, so that each new is paired with the free of
+     * the matching delete.
+     */
+    void *counted_allocate(size_t size) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        if (auto result = std::malloc(size ? size : 1)) {
+            return result;
+        }
+        throw std::bad_alloc{};
+    }
+
+    void counted_free(void *pointer) noexcept {
+        std::free(pointer);
+    }
+}
+
+void *operator new(size_t size) {
+    return counted_allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return counted_allocate(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    counted_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    counted_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    counted_free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+    counted_free(pointer);
+}
+
+int main(int argc, char **argv) {
+    bench::GeneratorOptions options;
+    size_t runs = 5;
+    if (!parse_options(argc, argv, options, runs)) {
+        std::cerr << "usage: " << argv[0] << " [--statements N] [--depth N] [--identifier N] [--whitespace P]"
+                  << " [--seed N] [--runs N]" << std::endl;
+        return 1;
+    }
+    auto text = bench::Generator(options).program();
+    auto megabytes = static_cast<double>(text.size()) / 1e6;
+
+    // streaming from a mapped file first, while the peak resident size is still that of the input
+    char stream_path[] = "/tmp/parse-stream-XXXXXX";
+    int stream_fd = ::mkstemp(stream_path);
+    if (stream_fd < 0 || ::write(stream_fd, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+        std::cerr << "cannot write the streaming input" << std::endl;
+        return 1;
+    }
+    ::close(stream_fd);
+    size_t streamed = 0;
+    auto stream_rss = peak_rss_kb();
+    auto stream_start = Clock::now();
+    bool matched = parser::stream_file<grammar::Toplevel>(stream_path, [&](parser::TreePtr) { streamed++; });
+    auto stream_ms = elapsed(stream_start);
+    stream_rss = peak_rss_kb() - stream_rss;
+    ::unlink(stream_path);
+
+    // parse throughput and allocations
+    std::vector<double> parse_times;
+    size_t allocations = 0, allocated = 0, arena = 0;
+    auto parse_rss = peak_rss_kb();
+    for (size_t run = 0; run < runs; ++run) {
+        auto session = std::make_shared<parser::ParseSession>();
+        auto count = allocation_count.load();
+        auto bytes = allocation_bytes.load();
+        auto start = Clock::now();
+        matched &= grammar::Toplevel().match(parser::PContext{session, text, 0, 0}) != nullptr;
+        parse_times.push_back(elapsed(start));
+        allocations = allocation_count.load() - count;
+        allocated = allocation_bytes.load() - bytes;
+        arena = session->arena.capacity();
+    }
+    auto parse_ms = median(parse_times);
+    parse_rss = peak_rss_kb() - parse_rss;
+#ifdef GRAMMAR_PROFILE
+    {
+        auto session = std::make_shared<parser::ParseSession>();
+        grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+        session->profiler.report(std::cerr);
+    }
+#endif
+
+    // a deadline at a quarter of the usual parse time
+    parser::ParseProgress progress;
+    double stopped_ms;
+    {
+        parser::ParseBudget budget;
+        auto session = std::make_shared<parser::ParseSession>();
+        auto start = Clock::now();
+        budget.deadline = start + std::chrono::microseconds(static_cast<int64_t>(parse_ms * 250));
+        matched &= parser::parse_budgeted<grammar::Toplevel>(session, text, budget, progress) == nullptr;
+        stopped_ms = elapsed(start);
+    }
+
+    // static dispatch
+    std::vector<double> static_times;
+    for (size_t run = 0; run < runs; ++run) {
+        parser::ParseSession session;
+        auto start = Clock::now();
+        matched &= parser::parse_static<grammar::Toplevel>(session, text) != nullptr;
+        static_times.push_back(elapsed(start));
+    }
+    auto static_ms = median(static_times);
+
+    // explicit continuation stack, and a nesting the native stack could not hold
+    std::vector<double> iterative_times;
+    for (size_t run = 0; run < runs; ++run) {
+        parser::ParseSession session;
+        auto start = Clock::now();
+        matched &= parser::parse_iterative<grammar::Toplevel>(session, text) != nullptr;
+        iterative_times.push_back(elapsed(start));
+    }
+    const size_t nesting = 1000000;
+    auto nested = "begin x := " + std::string(nesting, '(') + "1" + std::string(nesting, ')') + "; end";
+    double nested_ms;
+    {
+        parser::ParseSession session;
+        auto start = Clock::now();
+        matched &= parser::parse_iterative<grammar::Toplevel>(session, nested) != nullptr;
+        nested_ms = elapsed(start);
+    }
+
+    // the same language loaded from text at runtime
+    std::vector<double> load_times, loaded_times;
+    std::optional<parser::LoadedGrammar> loaded;
+    for (size_t run = 0; run < runs; ++run) {
+        std::string error;
+        auto start = Clock::now();
+        loaded = parser::load_grammar(micro_grammar, error);
+        load_times.push_back(elapsed(start));
+    }
+    for (size_t run = 0; loaded && run < runs; ++run) {
+        parser::ParseSession session;
+        auto start = Clock::now();
+        matched &= parser::parse_loaded(*loaded, session, text) != nullptr;
+        loaded_times.push_back(elapsed(start));
+    }
+    if (!loaded) {
+        std::cerr << "micro grammar does not load" << std::endl;
+        return 1;
+    }
+
+    // recognize-only mode
+    std::vector<double> recognize_times;
+    size_t recognize_allocations = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        auto count = allocation_count.load();
+        auto start = Clock::now();
+        matched &= parser::recognize<grammar::Toplevel>(text) == text.size();
+        recognize_times.push_back(elapsed(start));
+        recognize_allocations = allocation_count.load() - count;
+    }
+    auto recognize_ms = median(recognize_times);
+
+    // memory table footprint, with every entry kept
+    auto session = std::make_shared<parser::ParseSession>();
+    session->keep_memo = true;
+    auto tree = grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+    if (!matched || !tree) {
+        std::cerr << "generated program does not parse" << std::endl;
+        return 1;
+    }
+
+    // tree compression
+    std::vector<double> compress_times;
+    std::vector<parser::TreePtr> compressed;
+    parser::TreeArena target;
+    size_t compress_allocations = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        auto count = allocation_count.load();
+        auto start = Clock::now();
+        compressed = tree->compress<grammar::SelectRule>(target);
+        compress_times.push_back(elapsed(start));
+        compress_allocations = allocation_count.load() - count;
+    }
+
+    // flat serialization
+    std::vector<double> flatten_times;
+    size_t flat_bytes = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        auto start = Clock::now();
+        flat_bytes = parser::flatten(tree, text, "bench").size();
+        flatten_times.push_back(elapsed(start));
+    }
+
+    // buffered text and JSON dumps, into memory so that the stream does not dominate
+    std::vector<double> text_dump_times, json_dump_times;
+    size_t dump_bytes = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        std::ostringstream out;
+        auto start = Clock::now();
+        {
+            parser::TreeWriter writer{out};
+            writer.text(tree);
+        }
+        text_dump_times.push_back(elapsed(start));
+        dump_bytes = out.str().size();
+        out.str({});
+        start = Clock::now();
+        {
+            parser::TreeWriter writer{out};
+            writer.json(tree, text);
+        }
+        json_dump_times.push_back(elapsed(start));
+    }
+
+    // on-disk parse cache: one cold parse, then mapped hits
+    char cache_directory[] = "/tmp/parse-cache-XXXXXX";
+    if (!::mkdtemp(cache_directory)) {
+        std::cerr << "cannot create the cache directory" << std::endl;
+        return 1;
+    }
+    auto fingerprint = parser::grammar_fingerprint<grammar::SelectRule>();
+    parser::ParseCache cache{cache_directory, fingerprint};
+    double miss_ms;
+    {
+        parser::FlatTree cached;
+        auto start = Clock::now();
+        matched &= parser::parse_cached<grammar::Toplevel>(cache, text, "bench", cached);
+        miss_ms = elapsed(start);
+    }
+    std::vector<double> hit_times;
+    auto tree_nodes = count_nodes(tree);
+    for (size_t run = 0; run < runs; ++run) {
+        parser::FlatTree cached;
+        auto start = Clock::now();
+        matched &= parser::parse_cached<grammar::Toplevel>(cache, text, "bench", cached) && cached.size() == tree_nodes;
+        hit_times.push_back(elapsed(start));
+    }
+    parser::ParseCache{cache_directory, fingerprint, 0}.evict();
+    ::unlink((std::string(cache_directory) + "/.ledger").c_str());
+    ::rmdir(cache_directory);
+
+    // selected tree built during the parse
+    std::vector<double> select_times;
+    size_t select_allocations = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        parser::ParseSession selected;
+        auto count = allocation_count.load();
+        auto start = Clock::now();
+        parser::parse_selected<grammar::Toplevel, grammar::SelectRule>(selected, text);
+        select_times.push_back(elapsed(start));
+        select_allocations = allocation_count.load() - count;
+    }
+    // statement events without a tree
+    using StatementRules = parser::Selector<grammar::ReadStmt, grammar::WriteStmt, grammar::Assignment>;
+    std::vector<double> event_times;
+    size_t event_allocations = 0;
+    StatementCounter counter;
+    for (size_t run = 0; run < runs; ++run) {
+        counter.statements = 0;
+        auto count = allocation_count.load();
+        auto start = Clock::now();
+        matched &= parser::parse_events<grammar::Toplevel, StatementRules>(text, counter) == text.size();
+        event_times.push_back(elapsed(start));
+        event_allocations = allocation_count.load() - count;
+    }
+
+    size_t nodes = 0;
+    for (auto i : compressed) {
+        nodes += count_nodes(i);
+    }
+
+    // symbol table: one scope per block of identifiers
+    std::vector<std::string> names;
+    for (auto i : compressed) {
+        collect_identifiers(i, names);
+    }
+    const size_t block = 64;
+    double define_ms = 0, lookup_ms = 0, symbol_ms = 0, escape_ms = 0;
+    size_t found = 0, found_symbols = 0;
+    std::vector<symtable::Symbol> symbols;
+    for (size_t run = 0; run < runs; ++run) {
+        symtable::SymTable<size_t> table;
+        table.enter();
+        for (size_t offset = 0; offset < names.size(); offset += block) {
+            auto end = std::min(names.size(), offset + block);
+            table.enter();
+            auto start = Clock::now();
+            for (auto i = offset; i < end; ++i) {
+                table.define(names[i], i);
+            }
+            define_ms += elapsed(start);
+            start = Clock::now();
+            for (auto i = offset; i < end; ++i) {
+                found += table(names[i]).has_value();
+            }
+            lookup_ms += elapsed(start);
+            symbols.clear();
+            for (auto i = offset; i < end; ++i) {
+                symbols.push_back(table.intern(names[i]));
+            }
+            start = Clock::now();
+            for (auto i : symbols) {
+                found_symbols += table.find(i) != nullptr;
+            }
+            symbol_ms += elapsed(start);
+            start = Clock::now();
+            table.escape();
+            escape_ms += elapsed(start);
+        }
+    }
+
+    // identifiers through their automaton and through the combinators of their definition
+    std::string words;
+    std::vector<size_t> starts;
+    for (auto &i : names) {
+        starts.push_back(words.size());
+        words += i;
+        words += ' ';
+    }
+    std::vector<double> lexeme_times, combinator_times;
+    size_t lexed = 0, combined = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        auto start = Clock::now();
+        for (auto i : starts) {
+            lexed += parser::lex<grammar::Identity>(words, i);
+        }
+        lexeme_times.push_back(elapsed(start));
+        parser::Recognizer recognizer{words};
+        start = Clock::now();
+        for (auto i : starts) {
+            combined += recognizer.match<grammar::Identity::definition>(i);
+        }
+        combinator_times.push_back(elapsed(start));
+    }
+    matched &= lexed == combined;
+
+    // persistent symbol table: the same scopes, with a snapshot taken in each of them
+    symtable::Interner interner;
+    symbols.clear();
+    for (auto &i : names) {
+        symbols.push_back(interner.intern(i));
+    }
+    double persistent_define_ms = 0, persistent_lookup_ms = 0, snapshot_ms = 0, persistent_escape_ms = 0;
+    size_t found_persistent = 0;
+    for (size_t run = 0; run < runs; ++run) {
+        symtable::PersistentSymTable<size_t> table;
+        table.enter();
+        for (size_t offset = 0; offset < symbols.size(); offset += block) {
+            auto end = std::min(symbols.size(), offset + block);
+            table.enter();
+            auto start = Clock::now();
+            for (auto i = offset; i < end; ++i) {
+                table.define(symbols[i], i);
+            }
+            persistent_define_ms += elapsed(start);
+            start = Clock::now();
+            auto snapshot = table.snapshot();
+            snapshot_ms += elapsed(start);
+            start = Clock::now();
+            for (auto i = offset; i < end; ++i) {
+                found_persistent += snapshot.find(symbols[i]) != nullptr;
+            }
+            persistent_lookup_ms += elapsed(start);
+            start = Clock::now();
+            table.escape();
+            persistent_escape_ms += elapsed(start);
+        }
+    }
+
+    // bytecode against the tree-walking evaluator
+    std::vector<int64_t> input(names.size());
+    std::iota(input.begin(), input.end(), 1);
+    std::vector<double> compile_times, execute_times, evaluate_times;
+    std::optional<micro::Program> program;
+    std::vector<int64_t> vm_output, tree_output;
+    for (size_t run = 0; run < runs; ++run) {
+        auto start = Clock::now();
+        program = micro::compile(compressed.front());
+        compile_times.push_back(elapsed(start));
+        vm_output.clear();
+        start = Clock::now();
+        matched &= program && micro::execute(*program, input, vm_output);
+        execute_times.push_back(elapsed(start));
+        tree_output.clear();
+        start = Clock::now();
+        matched &= micro::evaluate(compressed.front(), input, tree_output);
+        evaluate_times.push_back(elapsed(start));
+    }
+    if (!matched || vm_output != tree_output) {
+        std::cerr << "bytecode and tree evaluation disagree" << std::endl;
+        return 1;
+    }
+
+    // many small documents on a warm pool
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < 2000; ++i) {
+        auto small = options;
+        small.statements = 20;
+        small.seed = options.seed + i + 1;
+        sources.push_back(bench::Generator(small).program());
+    }
+    std::vector<std::string_view> documents(sources.begin(), sources.end());
+    parser::ParsePool pool;
+    std::atomic<size_t> batch_nodes{0};
+    auto count_batch = [&](size_t, parser::TreePtr tree) {
+        batch_nodes.fetch_add(tree ? tree->subtrees().size() : 0, std::memory_order_relaxed);
+    };
+    parser::parse_many<grammar::Toplevel>(pool, documents, count_batch);
+    auto batch_count = allocation_count.load();
+    auto batch = parser::parse_many<grammar::Toplevel>(pool, documents, count_batch);
+    auto batch_allocations = allocation_count.load() - batch_count;
+    matched &= batch.failures == 0;
+
+    // one program on pools of growing size
+    auto hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<size_t> thread_counts{1};
+    for (size_t threads : {size_t{2}, size_t{4}, hardware}) {
+        if (threads > thread_counts.back()) {
+            thread_counts.push_back(threads);
+        }
+    }
+    std::vector<double> parallel_ms;
+    for (auto threads : thread_counts) {
+        parser::ParsePool workers{threads};
+        std::vector<double> times;
+        for (size_t run = 0; run < runs; ++run) {
+            auto parallel_session = std::make_shared<parser::ParseSession>();
+            auto start = Clock::now();
+            matched &= parser::parse_parallel<grammar::Toplevel, grammar::Stmt>(workers, parallel_session, text) !=
+                       nullptr;
+            times.push_back(elapsed(start));
+        }
+        parallel_ms.push_back(median(times));
+    }
+    std::ostringstream parallel_rows;
+    for (size_t i = 0; i < thread_counts.size(); ++i) {
+        parallel_rows << (i ? ", " : "") << "{\"threads\": " << thread_counts[i] << ", \"median_ms\": "
+                      << parallel_ms[i] << ", \"speedup\": " << parallel_ms[0] / parallel_ms[i] << "}";
+    }
+
+    auto symbol_ops = static_cast<double>(names.size() * runs);
+    auto scopes = static_cast<double>((names.size() + block - 1) / block * runs);
+
+    std::cout << "{\n"
+              << "  \"input\": {\"statements\": " << options.statements << ", \"depth\": " << options.depth
+              << ", \"identifier\": " << options.identifier << ", \"whitespace\": " << options.whitespace
+              << ", \"seed\": " << options.seed << ", \"bytes\": " << text.size() << "},\n"
+              << "  \"parse\": {\"runs\": " << runs << ", \"median_ms\": " << parse_ms
+              << ", \"mb_per_s\": " << megabytes / parse_ms * 1e3
+              << ", \"allocations\": " << allocations
+              << ", \"allocations_per_byte\": " << static_cast<double>(allocations) / text.size()
+              << ", \"allocated_bytes\": " << allocated << ", \"arena_bytes\": " << arena << "},\n"
+              << "  \"stream\": {\"ms\": " << stream_ms << ", \"mb_per_s\": " << megabytes / stream_ms * 1e3
+              << ", \"statements\": " << streamed << ", \"peak_rss_growth_kb\": " << stream_rss
+              << ", \"parse_peak_rss_growth_kb\": " << parse_rss << "},\n"
+              << "  \"budget\": {\"deadline_ms\": " << parse_ms / 4 << ", \"stopped_ms\": " << stopped_ms
+              << ", \"invocations\": " << progress.invocations << ", \"farthest\": " << progress.farthest
+              << ", \"examined\": " << progress.examined << "},\n"
+              << "  \"static\": {\"median_ms\": " << static_ms
+              << ", \"mb_per_s\": " << megabytes / static_ms * 1e3 << "},\n"
+              << "  \"iterative\": {\"median_ms\": " << median(iterative_times)
+              << ", \"mb_per_s\": " << megabytes / median(iterative_times) * 1e3
+              << ", \"nesting\": " << nesting << ", \"nested_ms\": " << nested_ms << "},\n"
+              << "  \"loaded\": {\"nodes\": " << loaded->graph.nodes.size() << ", \"load_ms\": " << median(load_times)
+              << ", \"median_ms\": " << median(loaded_times)
+              << ", \"mb_per_s\": " << megabytes / median(loaded_times) * 1e3
+              << ", \"slowdown\": " << median(loaded_times) / median(iterative_times) << "},\n"
+              << "  \"recognize\": {\"median_ms\": " << recognize_ms
+              << ", \"mb_per_s\": " << megabytes / recognize_ms * 1e3
+              << ", \"allocations\": " << recognize_allocations << "},\n"
+              << "  \"memo\": {\"entries\": " << session->table.size() << ", \"bytes\": " << session->table.bytes()
+              << ", \"bytes_per_input_byte\": " << static_cast<double>(session->table.bytes()) / text.size()
+              << "},\n"
+              << "  \"compress\": {\"median_ms\": " << median(compress_times)
+              << ", \"allocations\": " << compress_allocations << ", \"nodes\": " << nodes << "},\n"
+              << "  \"flat\": {\"median_ms\": " << median(flatten_times) << ", \"bytes\": " << flat_bytes
+              << "},\n"
+              << "  \"dump\": {\"text_ms\": " << median(text_dump_times) << ", \"json_ms\": " << median(json_dump_times)
+              << ", \"bytes\": " << dump_bytes
+              << ", \"mb_per_s\": " << static_cast<double>(dump_bytes) / 1e6 / median(text_dump_times) * 1e3
+              << "},\n"
+              << "  \"cache\": {\"miss_ms\": " << miss_ms << ", \"hit_ms\": " << median(hit_times)
+              << ", \"speedup\": " << parse_ms / median(hit_times) << "},\n"
+              << "  \"select\": {\"median_ms\": " << median(select_times)
+              << ", \"mb_per_s\": " << megabytes / median(select_times) * 1e3
+              << ", \"allocations\": " << select_allocations << "},\n"
+              << "  \"events\": {\"median_ms\": " << median(event_times)
+              << ", \"mb_per_s\": " << megabytes / median(event_times) * 1e3
+              << ", \"allocations\": " << event_allocations << ", \"statements\": " << counter.statements << "},\n"
+              << "  \"lexer\": {\"identifiers\": " << names.size() << ", \"bytes\": " << words.size()
+              << ", \"lexeme_ms\": " << median(lexeme_times) << ", \"combinator_ms\": " << median(combinator_times)
+              << ", \"speedup\": " << median(combinator_times) / median(lexeme_times) << "},\n"
+              << "  \"symtable\": {\"symbols\": " << names.size() << ", \"found\": " << found / runs
+              << ", \"found_by_symbol\": " << found_symbols / runs
+              << ", \"define_per_s\": " << symbol_ops / define_ms * 1e3
+              << ", \"lookup_per_s\": " << symbol_ops / lookup_ms * 1e3
+              << ", \"symbol_lookup_per_s\": " << symbol_ops / symbol_ms * 1e3
+              << ", \"escape_per_s\": " << scopes / escape_ms * 1e3 << "},\n"
+              << "  \"persistent\": {\"found\": " << found_persistent / runs
+              << ", \"define_per_s\": " << symbol_ops / persistent_define_ms * 1e3
+              << ", \"lookup_per_s\": " << symbol_ops / persistent_lookup_ms * 1e3
+              << ", \"snapshot_per_s\": " << scopes / snapshot_ms * 1e3
+              << ", \"escape_per_s\": " << scopes / persistent_escape_ms * 1e3 << "},\n"
+              << "  \"vm\": {\"instructions\": " << program->code.size()
+              << ", \"registers\": " << program->registers << ", \"outputs\": " << vm_output.size()
+              << ", \"compile_ms\": " << median(compile_times) << ", \"execute_ms\": " << median(execute_times)
+              << ", \"evaluate_ms\": " << median(evaluate_times)
+              << ", \"speedup\": " << median(evaluate_times) / median(execute_times) << "},\n"
+              << "  \"batch\": {\"workers\": " << pool.size() << ", \"documents\": " << batch.documents
+              << ", \"bytes\": " << batch.bytes << ", \"failures\": " << batch.failures
+              << ", \"documents_per_s\": " << batch.documents_per_second
+              << ", \"mb_per_s\": " << batch.megabytes_per_second << ", \"p50_us\": " << batch.p50_us
+              << ", \"p90_us\": " << batch.p90_us << ", \"p99_us\": " << batch.p99_us
+              << ", \"max_us\": " << batch.max_us << ", \"allocations\": " << batch_allocations << "},\n"
+              << "  \"parallel\": {\"hardware_threads\": " << hardware << ", \"runs\": [" << parallel_rows.str()
+              << "]}\n"
+              << "}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,160 @@
+//
+// Created by schrodinger on 2/10/21.
+//
+
+#ifndef FRONTEND_GENERATOR_H
+#define FRONTEND_GENERATOR_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace bench {
+
+    /*!
+     * Shape of a generated micro program.
+     */
+    struct GeneratorOptions {
+        /*!
+         * Number of statements.
+         */
+        size_t statements = 10000;
+        /*!
+         * Maximal nesting depth of parenthesized expressions.
+         */
+        size_t depth = 3;
+        /*!
+         * Length of identifiers.
+         */
+        size_t identifier = 6;
+        /*!
+         * Probability of whitespace after each token, between 0 and 1.
+         */
+        double whitespace = 0.5;
+        /*!
+         * Random seed.
+         */
+        uint64_t seed = 1;
+    };
+
+    /*!
+     * The Generator class. Produces valid programs of the micro language.
+     * Output depends only on the options: randomness comes from a fixed splitmix64 sequence, not from the
+     * implementation-defined standard distributions.
+     */
+    class Generator {
+        GeneratorOptions options;
+        uint64_t state;
+        std::string out{};
+
+        uint64_t next() {
+            auto z = (state += 0x9e3779b97f4a7c15u);
+            z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9u;
+            z = (z ^ (z >> 27u)) * 0x94d049bb133111ebu;
+            return z ^ (z >> 31u);
+        }
+
+        size_t below(size_t bound) {
+            return next() % bound;
+        }
+
+        bool chance(double probability) {
+            return static_cast<double>(next() >> 11u) * 0x1.0p-53 < probability;
+        }
+
+        void space() {
+            static const char blanks[] = {' ', ' ', ' ', '\n', '\t'};
+            for (size_t count = 0; count < 4 && chance(options.whitespace); ++count) {
+                out.push_back(blanks[below(sizeof(blanks))]);
+                if (out.back() == '\n') {
+                    out.append("  ");
+                }
+            }
+        }
+
+        void token(const char *text) {
+            out.append(text);
+            space();
+        }
+
+        void identifier() {
+            static const char head[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+            static const char tail[] = "abcdefghijklmnopqrstuvwxyz0123456789_";
+            out.push_back(head[below(sizeof(head) - 1)]);
+            for (size_t i = 1; i < options.identifier; ++i) {
+                out.push_back(tail[below(sizeof(tail) - 1)]);
+            }
+            space();
+        }
+
+        void primary(size_t depth) {
+            auto kind = below(depth ? 4 : 3);
+            if (kind == 3) {
+                token("(");
+                expression(depth - 1);
+                token(")");
+            } else if (kind == 2) {
+                out.append(std::to_string(below(100000)));
+                space();
+            } else {
+                identifier();
+            }
+        }
+
+        void expression(size_t depth) {
+            primary(depth);
+            for (auto terms = below(4); terms; --terms) {
+                token(below(2) ? "+" : "-");
+                primary(depth);
+            }
+        }
+
+        void statement() {
+            auto kind = below(4);
+            if (kind == 0) {
+                token("read");
+                token("(");
+                identifier();
+                for (auto count = below(3); count; --count) {
+                    token(",");
+                    identifier();
+                }
+                token(")");
+            } else if (kind == 1) {
+                token("write");
+                token("(");
+                expression(options.depth);
+                for (auto count = below(3); count; --count) {
+                    token(",");
+                    expression(options.depth);
+                }
+                token(")");
+            } else {
+                identifier();
+                token(":=");
+                expression(options.depth);
+            }
+            out.push_back(';');
+            out.append("\n  ");
+        }
+
+    public:
+        explicit Generator(GeneratorOptions options) : options(options), state(options.seed) {}
+
+        /*!
+         * Generate a program.
+         * @return program text.
+         */
+        std::string program() {
+            out.clear();
+            out.append("begin\n  ");
+            for (size_t i = 0; i < options.statements; ++i) {
+                statement();
+            }
+            out.append("end");
+            return std::move(out);
+        }
+    };
+}
+
+#endif //FRONTEND_GENERATOR_H
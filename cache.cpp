@@ -0,0 +1,221 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    /*!
+     * Age after which a temporary file is taken as left behind by a writer that died.
+     */
+    constexpr time_t abandoned_seconds = 3600;
+
+    std::string hex(uint64_t value) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string result(16, '0');
+        for (size_t i = 16; i-- > 0; value >>= 4u) {
+            result[i] = digits[value & 15u];
+        }
+        return result;
+    }
+
+    bool ends_with(std::string_view text, std::string_view suffix) {
+        return text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+    }
+
+    bool write_all(int fd, std::string_view bytes) {
+        while (!bytes.empty()) {
+            auto written = ::write(fd, bytes.data(), bytes.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes.remove_prefix(static_cast<size_t>(written));
+        }
+        return true;
+    }
+
+    /*!
+     * Ledger records are native 64-bit words: the size of a stored entry, or with this bit set the size of the whole
+     * cache found by an eviction.
+     */
+    constexpr uint64_t total_record = uint64_t{1} << 63u;
+
+    /*!
+     * Ledger size above which an eviction starts a new ledger.
+     */
+    constexpr off_t ledger_limit = 1 << 16;
+
+    std::string entry(const std::string &directory, uint64_t fingerprint, uint64_t hash, size_t size) {
+        return directory + "/" + hex(fingerprint) + "-" + hex(hash) + "-" + hex(size) + ".flat";
+    }
+}
+
+bool parser::ParseCache::open() const {
+    if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat info{};
+    return ::stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+std::string parser::ParseCache::path(std::string_view text) const {
+    return entry(directory, fingerprint, content_hash(text), text.size());
+}
+
+bool parser::ParseCache::find(std::string_view text, FlatTree &tree) const {
+    auto hash = content_hash(text);
+    auto file = entry(directory, fingerprint, hash, text.size());
+    if (!tree.open(file)) {
+        return false;
+    }
+    if (tree.source_hash() != hash || tree.source_size() != text.size()) {
+        tree = FlatTree{};
+        return false;
+    }
+    // the modification time orders entries for eviction
+    ::utimensat(AT_FDCWD, file.c_str(), nullptr, 0);
+    return true;
+}
+
+bool parser::ParseCache::store(std::string_view text, std::string_view bytes, FlatTree &tree) const {
+    static std::atomic<uint64_t> counter{0};
+    auto temporary = directory + "/.tmp-" + std::to_string(::getpid()) + "-" + std::to_string(counter++);
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    auto written = write_all(fd, bytes);
+    if (::close(fd) != 0 || !written || !tree.open(temporary) ||
+        ::rename(temporary.c_str(), path(text).c_str()) != 0) {
+        ::unlink(temporary.c_str());
+        tree = FlatTree{};
+        return false;
+    }
+    if (account(bytes.size())) {
+        evict();
+    }
+    return true;
+}
+
+bool parser::ParseCache::account(uint64_t size) const {
+    std::lock_guard<std::mutex> lock{mutex};
+    int fd = ::open((directory + "/.ledger").c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+    struct stat info{};
+    if (fd < 0 || ::fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return true;
+    }
+    if (info.st_ino != ledger.inode || static_cast<uint64_t>(info.st_size) < ledger.offset) {
+        // a new ledger, started by an eviction
+        ledger = Ledger{info.st_ino, 0, 0, false};
+    }
+    write_all(fd, {reinterpret_cast<const char *>(&size), sizeof(size)});
+    uint64_t records[512];
+    while (true) {
+        auto read = ::pread(fd, records, sizeof(records), static_cast<off_t>(ledger.offset));
+        if (read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read < static_cast<ssize_t>(sizeof(uint64_t))) {
+            break;
+        }
+        auto count = static_cast<size_t>(read) / sizeof(uint64_t);
+        for (size_t i = 0; i < count; ++i) {
+            if (records[i] & total_record) {
+                ledger.estimate = records[i] & ~total_record;
+                ledger.known = true;
+            } else {
+                ledger.estimate += records[i];
+            }
+        }
+        ledger.offset += count * sizeof(uint64_t);
+    }
+    ::close(fd);
+    return !ledger.known || ledger.estimate > capacity;
+}
+
+uint64_t parser::ParseCache::evict() const {
+    auto record = [&](uint64_t total) {
+        auto ledger_path = directory + "/.ledger";
+        uint64_t value = total | total_record;
+        struct stat info{};
+        if (::stat(ledger_path.c_str(), &info) == 0 && info.st_size > ledger_limit) {
+            // start a new ledger from the total, readers notice the new file
+            static std::atomic<uint64_t> counter{0};
+            auto temporary = directory + "/.tmp-" + std::to_string(::getpid()) + "-l" + std::to_string(counter++);
+            int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd >= 0) {
+                auto written = write_all(fd, {reinterpret_cast<const char *>(&value), sizeof(value)});
+                if (::close(fd) == 0 && written && ::rename(temporary.c_str(), ledger_path.c_str()) == 0) {
+                    return;
+                }
+                ::unlink(temporary.c_str());
+            }
+        }
+        int fd = ::open(ledger_path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd >= 0) {
+            write_all(fd, {reinterpret_cast<const char *>(&value), sizeof(value)});
+            ::close(fd);
+        }
+    };
+    struct Entry {
+        std::string name;
+        uint64_t size;
+        timespec time;
+    };
+    auto dir = ::opendir(directory.c_str());
+    if (!dir) {
+        return 0;
+    }
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    auto now = ::time(nullptr);
+    while (auto item = ::readdir(dir)) {
+        std::string_view name = item->d_name;
+        struct stat info{};
+        if (::fstatat(::dirfd(dir), item->d_name, &info, 0) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        if (name.substr(0, 5) == ".tmp-" && now - info.st_mtim.tv_sec > abandoned_seconds) {
+            ::unlinkat(::dirfd(dir), item->d_name, 0);
+        } else if (ends_with(name, ".flat")) {
+            entries.push_back({std::string(name), static_cast<uint64_t>(info.st_size), info.st_mtim});
+            total += info.st_size;
+        }
+    }
+    ::closedir(dir);
+    if (total <= capacity) {
+        record(total);
+        return total;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.time.tv_sec != b.time.tv_sec ? a.time.tv_sec < b.time.tv_sec : a.time.tv_nsec < b.time.tv_nsec;
+    });
+    // leave room below the capacity, so that the next stores do not scan again
+    auto target = capacity - capacity / 8;
+    for (auto &i : entries) {
+        if (total <= target) {
+            break;
+        }
+        // another process may have evicted the entry already
+        auto file = directory + "/" + i.name;
+        if (::unlink(file.c_str()) == 0 || errno == ENOENT) {
+            total -= i.size;
+        }
+    }
+    record(total);
+    return total;
+}
@@ -0,0 +1,178 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/dump.h"
+#include <charconv>
+
+std::string_view parser::TreeWriter::name(size_t rule) {
+    if (rule >= names.size()) {
+        names.resize(rule + 1);
+    }
+    if (names[rule].empty()) {
+        names[rule] = rule_name(rule);
+    }
+    return names[rule];
+}
+
+void parser::TreeWriter::escape(std::string_view text) {
+    // same escapes as escaped_string, with the plain runs copied at once
+    size_t plain = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char *escaped;
+        switch (text[i]) {
+            case '\'':
+                escaped = "\\'";
+                break;
+            case '\"':
+                escaped = "\\\"";
+                break;
+            case '\?':
+                escaped = "\\?";
+                break;
+            case '\\':
+                escaped = "\\\\";
+                break;
+            case '\a':
+                escaped = "\\a";
+                break;
+            case '\b':
+                escaped = "\\b";
+                break;
+            case '\f':
+                escaped = "\\f";
+                break;
+            case '\n':
+                escaped = "\\n";
+                break;
+            case '\r':
+                escaped = "\\r";
+                break;
+            case '\t':
+                escaped = "\\t";
+                break;
+            case '\v':
+                escaped = "\\v";
+                break;
+            default:
+                continue;
+        }
+        buffer.append(text.data() + plain, i - plain);
+        buffer.append(escaped, 2);
+        plain = i + 1;
+    }
+    buffer.append(text.data() + plain, text.size() - plain);
+}
+
+void parser::TreeWriter::json_escape(std::string_view text) {
+    static constexpr char digits[] = "0123456789abcdef";
+    size_t plain = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        auto ch = static_cast<unsigned char>(text[i]);
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        buffer.append(text.data() + plain, i - plain);
+        plain = i + 1;
+        switch (ch) {
+            case '"':
+                buffer += "\\\"";
+                break;
+            case '\\':
+                buffer += "\\\\";
+                break;
+            case '\n':
+                buffer += "\\n";
+                break;
+            case '\r':
+                buffer += "\\r";
+                break;
+            case '\t':
+                buffer += "\\t";
+                break;
+            default:
+                buffer += "\\u00";
+                buffer += digits[ch >> 4u];
+                buffer += digits[ch & 15u];
+        }
+    }
+    buffer.append(text.data() + plain, text.size() - plain);
+}
+
+void parser::TreeWriter::number(size_t value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer.append(digits, result.ptr);
+}
+
+void parser::TreeWriter::reserve() {
+    if (buffer.size() >= block) {
+        flush();
+    }
+}
+
+void parser::TreeWriter::flush() {
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+}
+
+void parser::TreeWriter::text(TreePtr tree, int depth) {
+    if (!tree) {
+        return;
+    }
+    stack.clear();
+    stack.emplace_back(tree, depth);
+    while (!stack.empty()) {
+        auto [node, level] = stack.back();
+        stack.pop_back();
+        buffer.append(level * 4, ' ');
+        buffer += "- ";
+        buffer += name(node->rule);
+        buffer += ", parsed: \"";
+        escape(node->parsed_region);
+        buffer += "\"\n";
+        for (auto i = node->subtrees().size(); i-- > 0;) {
+            stack.emplace_back(node->subtrees()[i], level + 1);
+        }
+        reserve();
+    }
+}
+
+void parser::TreeWriter::json(TreePtr tree, std::string_view source) {
+    // each frame holds an inner node and the number of its children already printed
+    auto open = [&](TreePtr node) {
+        buffer += "{\"rule\":\"";
+        json_escape(name(node->rule));
+        buffer += "\",\"offset\":";
+        number(static_cast<size_t>(node->parsed_region.data() - source.data()));
+        buffer += ",\"length\":";
+        number(node->parsed_region.size());
+        if (node->subtrees().empty()) {
+            buffer += ",\"text\":\"";
+            json_escape(node->parsed_region);
+            buffer += "\"}";
+        } else {
+            buffer += ",\"children\":[";
+            stack.emplace_back(node, 0);
+        }
+        reserve();
+    };
+    if (!tree) {
+        buffer += "null";
+        return;
+    }
+    stack.clear();
+    open(tree);
+    while (!stack.empty()) {
+        auto &[node, printed] = stack.back();
+        if (printed == node->subtrees().size()) {
+            buffer += "]}";
+            stack.pop_back();
+            continue;
+        }
+        if (printed) {
+            buffer += ',';
+        }
+        open(node->subtrees()[printed++]);
+    }
+}
@@ -0,0 +1,32 @@
+//
+// Created by schrodinger on 2/15/21.
+//
+
+#include "grammar/events.h"
+
+void parser::EventTable::insert(const MemoKey &key, size_t length, const PendingEvent *first,
+                                const PendingEvent *last) {
+    if (key.first < base || (length != no_match && length >= UINT32_MAX - 2) ||
+        pool.size() + (last - first) >= UINT32_MAX) {
+        return;
+    }
+    if (key.second >= columns.size()) {
+        columns.resize(key.second + 1);
+    }
+    auto &column = columns[key.second];
+    auto index = key.first - base;
+    if (index >= column.size()) {
+        column.resize(index + 1);
+    }
+    column[index] = {length == no_match ? 1 : static_cast<uint32_t>(length + 2), static_cast<uint32_t>(pool.size()),
+                     static_cast<uint32_t>(last - first)};
+    pool.insert(pool.end(), first, last);
+}
+
+void parser::EventTable::retire(size_t position) {
+    for (auto &column : columns) {
+        column.clear();
+    }
+    pool.clear();
+    base = std::max(base, position);
+}
@@ -0,0 +1,193 @@
+//
+// Created by schrodinger on 2/14/21.
+//
+
+#include "grammar/flat.h"
+#include <fstream>
+
+namespace {
+    constexpr char flat_magic[8] = {'P', 'E', 'G', 'F', 'L', 'A', 'T', '\0'};
+    constexpr uint32_t flat_byte_order = 0x01020304u;
+    constexpr uint32_t flat_version = 1;
+
+    size_t align(size_t offset) {
+        return (offset + 7u) & ~size_t{7};
+    }
+
+    struct Flattener {
+        std::string_view text;
+        std::vector<parser::FlatNode> nodes{};
+        std::vector<uint32_t> rules{};
+        /*!
+         * Index in the rule name table plus one, by rule id; zero for rules not seen yet.
+         */
+        std::vector<uint32_t> ids{};
+
+        /*!
+         * Open nodes: the tree, its index in the node array, and the number of its children already visited.
+         */
+        struct Frame {
+            parser::TreePtr tree;
+            size_t index;
+            size_t visited;
+        };
+        std::vector<Frame> stack{};
+
+        void open(parser::TreePtr tree) {
+            if (tree->rule >= ids.size()) {
+                ids.resize(tree->rule + 1);
+            }
+            auto &rule = ids[tree->rule];
+            if (!rule) {
+                rules.push_back(tree->rule);
+                rule = static_cast<uint32_t>(rules.size());
+            }
+            stack.push_back({tree, nodes.size(), 0});
+            nodes.push_back({static_cast<uint64_t>(tree->parsed_region.data() - text.data()),
+                             tree->parsed_region.size(), rule - 1,
+                             static_cast<uint32_t>(tree->subtrees().size()), 0});
+        }
+
+        /*!
+         * Append a tree in preorder, walking it with an explicit stack so that any tree the parser can build can
+         * be flattened.
+         */
+        void visit(parser::TreePtr tree) {
+            open(tree);
+            while (!stack.empty()) {
+                auto &frame = stack.back();
+                if (frame.visited == frame.tree->subtrees().size()) {
+                    nodes[frame.index].descendants = nodes.size() - frame.index - 1;
+                    stack.pop_back();
+                    continue;
+                }
+                open(frame.tree->subtrees()[frame.visited++]);
+            }
+        }
+    };
+}
+
+uint64_t parser::content_hash(std::string_view text) {
+    uint64_t hash = 0xcbf29ce484222325u;
+    for (auto c : text) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3u;
+    }
+    return hash;
+}
+
+std::string parser::flatten(TreePtr tree, std::string_view text, std::string_view source_name) {
+    Flattener flattener{text};
+    flattener.visit(tree);
+    std::vector<std::string> names;
+    size_t names_size = 0;
+    for (auto rule : flattener.rules) {
+        names.emplace_back(rule_name(rule));
+        names_size += names.back().size();
+    }
+
+    FlatHeader header{};
+    std::copy(std::begin(flat_magic), std::end(flat_magic), header.magic);
+    header.byte_order = flat_byte_order;
+    header.version = flat_version;
+    header.node_count = flattener.nodes.size();
+    header.nodes_offset = align(sizeof(FlatHeader));
+    header.rule_count = names.size();
+    header.names_offset = header.nodes_offset + flattener.nodes.size() * sizeof(FlatNode);
+    auto chars = header.names_offset + (names.size() + 1) * sizeof(uint64_t);
+    header.source_offset = chars + names_size;
+    header.source_name_size = source_name.size();
+    header.source_size = text.size();
+    header.source_hash = content_hash(text);
+    header.file_size = header.source_offset + source_name.size();
+
+    std::string result(header.file_size, '\0');
+    auto data = result.data();
+    std::memcpy(data, &header, sizeof(header));
+    std::memcpy(data + header.nodes_offset, flattener.nodes.data(), flattener.nodes.size() * sizeof(FlatNode));
+    auto offsets = data + header.names_offset;
+    auto cursor = chars;
+    for (size_t i = 0; i <= names.size(); ++i) {
+        uint64_t offset = cursor;
+        std::memcpy(offsets + i * sizeof(uint64_t), &offset, sizeof(offset));
+        if (i < names.size()) {
+            std::memcpy(data + cursor, names[i].data(), names[i].size());
+            cursor += names[i].size();
+        }
+    }
+    std::memcpy(data + header.source_offset, source_name.data(), source_name.size());
+    return result;
+}
+
+bool parser::write_flat(const std::string &path, TreePtr tree, std::string_view text, std::string_view source_name) {
+    auto bytes = flatten(tree, text, source_name);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(out.flush());
+}
+
+bool parser::FlatTree::open(const std::string &path) {
+    if (!file.open(path)) {
+        header = nullptr;
+        return false;
+    }
+    if (!load(file.text())) {
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool parser::FlatTree::load(std::string_view bytes) {
+    header = nullptr;
+    if (bytes.size() < sizeof(FlatHeader) || reinterpret_cast<uintptr_t>(bytes.data()) % 8 != 0) {
+        return false;
+    }
+    auto candidate = reinterpret_cast<const FlatHeader *>(bytes.data());
+    if (!std::equal(std::begin(flat_magic), std::end(flat_magic), candidate->magic) ||
+        candidate->byte_order != flat_byte_order || candidate->version != flat_version ||
+        candidate->file_size != bytes.size()) {
+        return false;
+    }
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t width) {
+        return offset <= bytes.size() && count <= (bytes.size() - offset) / width;
+    };
+    if (candidate->nodes_offset % 8 != 0 || candidate->names_offset % 8 != 0 ||
+        !fits(candidate->nodes_offset, candidate->node_count, sizeof(FlatNode)) ||
+        !fits(candidate->names_offset, candidate->rule_count + 1, sizeof(uint64_t)) ||
+        !fits(candidate->source_offset, candidate->source_name_size, 1)) {
+        return false;
+    }
+    base = bytes.data();
+    nodes = reinterpret_cast<const FlatNode *>(base + candidate->nodes_offset);
+    names = reinterpret_cast<const uint64_t *>(base + candidate->names_offset);
+    for (size_t i = 0; i < candidate->rule_count; ++i) {
+        if (names[i] > names[i + 1] || names[i + 1] > bytes.size()) {
+            return false;
+        }
+    }
+    header = candidate;
+    return true;
+}
+
+const parser::FlatNode &parser::FlatCursor::node() const {
+    return tree->nodes[index];
+}
+
+std::string_view parser::FlatCursor::rule() const {
+    return node().rule < tree->rules() ? tree->rule_name(node().rule) : std::string_view{};
+}
+
+parser::FlatCursor parser::FlatCursor::first_child() const {
+    if (!node().children) {
+        return {};
+    }
+    return {tree, index + 1, index + 1 + std::min<size_t>(node().descendants, end - index - 1)};
+}
+
+parser::FlatCursor parser::FlatCursor::next_sibling() const {
+    auto next = index + 1 + std::min<size_t>(node().descendants, end - index - 1);
+    if (next >= end) {
+        return {};
+    }
+    return {tree, next, end};
+}
@@ -3,28 +3,541 @@
 //
 
 #include "frontend.h"
+#include "grammar/dump.h"
 #include <cxxabi.h>
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <limits>
 
-size_t parser::MemoKeyHasher::operator()(const MemoKey &key) const {
-    return key.first ^ key.second.hash_code();
+namespace {
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_map<std::type_index, size_t> ids;
+        std::vector<std::type_index> types;
+        std::vector<std::string_view> names;
+        /*!
+         * Demangled names of the types registered without a name.
+         */
+        std::deque<std::string> demangled;
+    };
+
+    Registry &registry() {
+        static Registry instance;
+        return instance;
+    }
+}
+
+size_t parser::rule_id(std::type_index index) {
+    auto &registry = ::registry();
+    std::lock_guard<std::mutex> guard{registry.mutex};
+    auto result = registry.ids.emplace(index, registry.types.size());
+    if (result.second) {
+        registry.types.push_back(index);
+        registry.names.emplace_back(registry.demangled.emplace_back(demangle(index)));
+    }
+    return result.first->second;
 }
 
-parser::MemoKey parser::PContext::key(const std::type_info &index) const {
-    return {start_position, index};
+size_t parser::rule_id(std::type_index index, std::string_view name) {
+    auto &registry = ::registry();
+    std::lock_guard<std::mutex> guard{registry.mutex};
+    auto result = registry.ids.emplace(index, registry.types.size());
+    if (result.second) {
+        registry.types.push_back(index);
+        registry.names.push_back(name);
+    }
+    return result.first->second;
+}
+
+std::string_view parser::rule_name(size_t id) {
+    auto &registry = ::registry();
+    std::lock_guard<std::mutex> guard{registry.mutex};
+    return id < registry.names.size() ? registry.names[id] : std::string_view{};
+}
+
+std::type_index parser::rule_type(size_t id) {
+    auto &registry = ::registry();
+    std::lock_guard<std::mutex> guard{registry.mutex};
+    return id < registry.types.size() ? registry.types[id] : typeid(void);
+}
+
+std::string parser::demangle(std::type_index index) {
+    int status;
+    auto name = abi::__cxa_demangle(index.name(), nullptr, nullptr, &status);
+    if (!name) {
+        return index.name();
+    }
+    std::string result{name};
+    std::free(name);
+    return result;
+}
+
+size_t parser::Grammar::id() const {
+    return rule_id(typeid(*this));
+}
+
+bool parser::Grammar::memoized() const {
+    return true;
+}
+
+const parser::MemoSlot parser::MemoTable::failure{0, nullptr};
+
+void parser::MemoTable::insert(const MemoKey &key, TreePtr tree, size_t reach) {
+    if (key.first < base) {
+        return;
+    }
+    auto index = this->index(key.first);
+    if (reach > key.first) {
+        if (index >= reaches.size()) {
+            reaches.resize(index + 1);
+        }
+        auto distance = static_cast<uint32_t>(std::min<size_t>(reach - key.first, UINT32_MAX));
+        if (distance > reaches[index]) {
+            reaches[index] = distance;
+            if (!ends.empty()) {
+                track(index, true);
+            }
+        }
+    }
+    if (key.second >= columns.size()) {
+        columns.resize(key.second + 1);
+    }
+    auto &column = columns[key.second];
+    if (index < column.success.size() && column.success[index]) {
+        return;
+    }
+    if (tree) {
+        if (index >= column.success.size()) {
+            column.success.resize(index + 1);
+        }
+        auto length = tree->parsed_region.size();
+        slots.push_back({length, tree});
+        column.success[index] = static_cast<uint32_t>(slots.size());
+        successes++;
+    } else {
+        auto word = index >> 6u;
+        auto bit = uint64_t{1} << (index & 63u);
+        if (word >= column.failed.size()) {
+            column.failed.resize(word + 1);
+        }
+        if (!(column.failed[word] & bit)) {
+            column.failed[word] |= bit;
+            failures++;
+        }
+    }
+}
+
+size_t parser::MemoTable::size() const {
+    return successes + failures;
+}
+
+size_t parser::MemoTable::bytes() const {
+    auto result = columns.capacity() * sizeof(Column) + slots.capacity() * sizeof(MemoSlot) +
+                  reaches.capacity() * sizeof(uint32_t) + segments.capacity() * sizeof(Segment) +
+                  ends.capacity() * sizeof(size_t);
+    for (auto &column : columns) {
+        result += column.failed.capacity() * sizeof(uint64_t) + column.success.capacity() * sizeof(uint32_t);
+    }
+    return result;
+}
+
+void parser::MemoTable::clear() {
+    columns.clear();
+    slots.clear();
+    reaches.clear();
+    segments.clear();
+    ends.clear();
+    successes = 0;
+    failures = 0;
+    base = 0;
+    extent = 0;
+}
+
+void parser::MemoTable::retire(size_t position) {
+    for (auto &column : columns) {
+        column.failed.clear();
+        column.success.clear();
+    }
+    slots.clear();
+    reaches.clear();
+    segments.clear();
+    ends.clear();
+    successes = 0;
+    failures = 0;
+    extent = 0;
+    base = std::max(base, position);
+}
+
+void parser::MemoTable::reset() {
+    retire(0);
+    base = 0;
+}
+
+size_t parser::MemoTable::block_end(size_t block) const {
+    size_t result = 0;
+    for (auto i = block * block_size; i < std::min((block + 1) * block_size, reaches.size()); ++i) {
+        if (reaches[i]) {
+            result = std::max(result, i + reaches[i]);
+        }
+    }
+    return result;
+}
+
+void parser::MemoTable::track(size_t index, bool raised) {
+    auto leaves = ends.size() / 2;
+    auto block = index / block_size;
+    if (block >= leaves) {
+        rebuild(index + 1);
+        return;
+    }
+    auto node = leaves + block;
+    auto end = reaches[index] ? index + reaches[index] : 0;
+    if (raised) {
+        // a raised reach only needs the maxima below it
+        for (; node && ends[node] < end; node /= 2) {
+            ends[node] = end;
+        }
+        return;
+    }
+    ends[node] = block_end(block);
+    for (node /= 2; node; node /= 2) {
+        ends[node] = std::max(ends[2 * node], ends[2 * node + 1]);
+    }
+}
+
+void parser::MemoTable::rebuild(size_t count) {
+    size_t leaves = 64;
+    while (leaves * block_size < count) {
+        leaves *= 2;
+    }
+    ends.assign(2 * leaves, 0);
+    for (size_t block = 0; block * block_size < reaches.size(); ++block) {
+        ends[leaves + block] = block_end(block);
+    }
+    for (auto node = leaves - 1; node; --node) {
+        ends[node] = std::max(ends[2 * node], ends[2 * node + 1]);
+    }
+}
+
+void parser::MemoTable::crossing(size_t low, size_t high, size_t threshold, std::vector<size_t> &found) const {
+    struct Range {
+        size_t node, low, high;
+    };
+    auto leaves = ends.size() / 2;
+    std::vector<Range> pending{{1, 0, leaves * block_size}};
+    while (!pending.empty()) {
+        auto range = pending.back();
+        pending.pop_back();
+        if (range.high <= low || high <= range.low || ends[range.node] <= threshold) {
+            continue;
+        }
+        if (range.node >= leaves) {
+            for (auto i = std::max(range.low, low); i < std::min({range.high, high, reaches.size()}); ++i) {
+                if (reaches[i] && i + reaches[i] > threshold) {
+                    found.push_back(i);
+                }
+            }
+            continue;
+        }
+        auto middle = (range.low + range.high) / 2;
+        pending.push_back({2 * range.node, range.low, middle});
+        pending.push_back({2 * range.node + 1, middle, range.high});
+    }
+}
+
+void parser::MemoTable::drop(size_t index) {
+    for (auto &column : columns) {
+        if (index < column.success.size() && column.success[index]) {
+            column.success[index] = 0;
+            successes--;
+        }
+        auto word = index >> 6u;
+        auto bit = uint64_t{1} << (index & 63u);
+        if (word < column.failed.size() && (column.failed[word] & bit)) {
+            column.failed[word] &= ~bit;
+            failures--;
+        }
+    }
+    if (index < reaches.size() && reaches[index]) {
+        reaches[index] = 0;
+        track(index, false);
+    }
+}
+
+void parser::MemoTable::discard(size_t low, size_t high) {
+    for (auto &column : columns) {
+        for (auto index = low; index < std::min(high, column.success.size()); ++index) {
+            if (column.success[index]) {
+                column.success[index] = 0;
+                successes--;
+            }
+        }
+        for (auto index = low; index < std::min(high, column.failed.size() << 6u);) {
+            auto word = index >> 6u;
+            auto count = std::min<size_t>(64 - (index & 63u), high - index);
+            auto mask = (count == 64 ? ~uint64_t{0} : (uint64_t{1} << count) - 1) << (index & 63u);
+            failures -= __builtin_popcountll(column.failed[word] & mask);
+            column.failed[word] &= ~mask;
+            index += count;
+        }
+    }
+}
+
+void parser::MemoTable::edit(size_t offset, size_t removed, size_t inserted, size_t size) {
+    if (offset < base) {
+        retire(base);
+        return;
+    }
+    if (segments.empty()) {
+        segments.push_back({base, 0});
+    }
+    extent = std::max(extent, index(size) + 1);
+    if (ends.empty()) {
+        rebuild(extent);
+    }
+    auto next = [&](size_t k) {
+        return k + 1 < segments.size() ? segments[k + 1].position : static_cast<size_t>(-1);
+    };
+    // positions before the edit whose entries examined the edited range
+    std::vector<size_t> damaged;
+    for (size_t k = 0; k < segments.size() && segments[k].position < offset; ++k) {
+        auto &segment = segments[k];
+        auto end = std::min(next(k), offset);
+        crossing(segment.index, segment.index + (end - segment.position),
+                 segment.index + (offset - segment.position), damaged);
+    }
+    // entries right after an edit at the input start change their distance to it
+    if (offset == 0 && removed != inserted) {
+        damaged.push_back(index(removed));
+    }
+    for (auto index : damaged) {
+        drop(index);
+    }
+    // entries inside the removed range are no longer reachable
+    for (size_t k = 0; k < segments.size() && segments[k].position < offset + removed; ++k) {
+        auto low = std::max(segments[k].position, offset);
+        auto high = std::min(next(k), offset + removed);
+        if (low < high) {
+            discard(segments[k].index + (low - segments[k].position), segments[k].index + (high - segments[k].position));
+        }
+    }
+    // the inserted bytes get fresh storage, the positions after the edit move
+    std::vector<Segment> result;
+    auto add = [&](size_t position, size_t index) {
+        if (result.empty() || result.back().index + (position - result.back().position) != index) {
+            result.push_back({position, index});
+        }
+    };
+    bool placed = false;
+    auto place = [&]() {
+        if (!placed && inserted) {
+            result.push_back({offset, extent});
+            extent += inserted;
+        }
+        placed = true;
+    };
+    for (size_t k = 0; k < segments.size(); ++k) {
+        auto position = segments[k].position, end = next(k);
+        if (position < offset) {
+            add(position, segments[k].index);
+        }
+        if (end > offset + removed) {
+            place();
+            auto from = std::max(position, offset + removed);
+            add(from - removed + inserted, segments[k].index + (from - position));
+        }
+    }
+    segments.swap(result);
+}
+
+parser::TreePtr parser::ParseSession::relocate(TreePtr tree, std::string_view text, size_t position) {
+    auto begin = reinterpret_cast<uintptr_t>(text.data());
+    auto current = [&](TreePtr node) {
+        auto address = reinterpret_cast<uintptr_t>(node->parsed_region.data());
+        return address >= begin && address <= begin + text.size();
+    };
+    if (current(tree)) {
+        return tree;
+    }
+    // no edit touched the input a reused tree examined, so all of its old nodes move by the same distance
+    auto distance = begin + position - reinterpret_cast<uintptr_t>(tree->parsed_region.data());
+    auto mark = stack.size();
+    stack.push_back(tree);
+    while (stack.size() > mark) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (current(node)) {
+            continue;
+        }
+        auto address = reinterpret_cast<uintptr_t>(node->parsed_region.data()) + distance;
+        node->parsed_region = {reinterpret_cast<const char *>(address), node->parsed_region.size()};
+        stack.insert(stack.end(), node->subtrees().begin(), node->subtrees().end());
+    }
+    return tree;
+}
+
+void parser::Profiler::clear() {
+    rules.clear();
+    active.clear();
+}
+
+void parser::Profiler::report(std::ostream &out, size_t limit) const {
+    std::vector<size_t> order;
+    for (size_t id = 0; id < rules.size(); ++id) {
+        if (rules[id].invocations) {
+            order.push_back(id);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return rules[a].exclusive_ns > rules[b].exclusive_ns;
+    });
+    if (limit && order.size() > limit) {
+        order.resize(limit);
+    }
+    auto milliseconds = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+    out << "self ms\ttotal ms\tcalls\thits\tmisses\tsuccesses\tfailures\tbytes\tbacktrack\trule" << std::endl;
+    for (auto id : order) {
+        auto &rule = rules[id];
+        out << milliseconds(rule.exclusive_ns) << '\t' << milliseconds(rule.inclusive_ns) << '\t'
+            << rule.invocations << '\t' << rule.hits << '\t' << rule.misses << '\t'
+            << rule.successes << '\t' << rule.failures << '\t' << rule.bytes << '\t'
+            << rule.max_backtrack << '\t' << rule_name(id) << std::endl;
+    }
+}
+
+parser::TreeArena::~TreeArena() {
+    for (auto list : {head, spare, adopted}) {
+        while (list) {
+            auto next = list->next;
+            ::operator delete(list);
+            list = next;
+        }
+    }
+}
+
+void parser::TreeArena::grow(size_t bytes) {
+    Chunk *chunk;
+    if (spare && spare->capacity >= bytes) {
+        chunk = spare;
+        spare = spare->next;
+    } else {
+        size_t capacity = head ? std::min<size_t>(head->capacity * 2, 16u << 20u) : 64u << 10u;
+        capacity = std::max(capacity, bytes);
+        chunk = static_cast<Chunk *>(::operator new(sizeof(Chunk) + capacity));
+        chunk->capacity = capacity;
+        reserved += capacity;
+        chunk_count++;
+    }
+    chunk->next = head;
+    head = chunk;
+    cursor = reinterpret_cast<uintptr_t>(chunk + 1);
+    limit = cursor + chunk->capacity;
+}
+
+void parser::TreeArena::release(const Mark &mark) {
+    while (head != mark.chunk) {
+        auto next = head->next;
+        head->next = spare;
+        spare = head;
+        head = next;
+    }
+    cursor = mark.cursor;
+    limit = head ? reinterpret_cast<uintptr_t>(head + 1) + head->capacity : 0;
+    used = mark.used;
+}
+
+void parser::TreeArena::adopt(TreeArena &that) {
+    for (auto list : {that.head, that.spare, that.adopted}) {
+        while (list) {
+            auto next = list->next;
+            list->next = adopted;
+            adopted = list;
+            list = next;
+        }
+    }
+    reserved += that.reserved;
+    chunk_count += that.chunk_count;
+    that.head = that.spare = that.adopted = nullptr;
+    that.cursor = that.limit = 0;
+    that.used = that.reserved = that.chunk_count = 0;
+}
+
+parser::TreeSpan parser::TreeArena::span(const TreePtr *first, size_t count) {
+    if (count == 0) {
+        return {};
+    }
+    if (count > std::numeric_limits<uint32_t>::max()) {
+        // a node cannot hold the count, and a parse must not go on with a tree that drops children
+        std::abort();
+    }
+    auto data = static_cast<TreePtr *>(allocate(count * sizeof(TreePtr), alignof(TreePtr)));
+    std::copy(first, first + count, data);
+    return {data, static_cast<uint32_t>(count)};
+}
+
+size_t parser::TreeArena::allocated() const {
+    return used;
+}
+
+size_t parser::TreeArena::capacity() const {
+    return reserved;
+}
+
+size_t parser::TreeArena::chunks() const {
+    return chunk_count;
+}
+
+parser::MemoKey parser::PContext::key(size_t rule) const {
+    return {start_position, rule};
+}
+
+bool parser::ParseSession::check() {
+    if (progress.exhausted == Exhausted::None) {
+        progress.invocations += window;
+        if (progress.invocations > budget.invocations) {
+            progress.exhausted = Exhausted::Invocations;
+        } else if (table.size() > budget.memo_entries) {
+            progress.exhausted = Exhausted::MemoEntries;
+        } else if (budget.memory != ParseBudget::unlimited && table.bytes() + arena.allocated() > budget.memory) {
+            progress.exhausted = Exhausted::Memory;
+        } else if (budget.deadline != std::chrono::steady_clock::time_point::max() &&
+                   std::chrono::steady_clock::now() >= budget.deadline) {
+            progress.exhausted = Exhausted::Deadline;
+        } else {
+            auto remaining = budget.invocations - progress.invocations;
+            auto interval = std::max<size_t>(budget.interval, 1);
+            window = countdown = remaining < interval ? remaining + 1 : interval;
+            return true;
+        }
+        // the refused invocation does not count
+        progress.invocations--;
+    }
+    window = countdown = 1;
+    return false;
+}
+
+void parser::ParseSession::limit(const ParseBudget &limits) {
+    budget = limits;
+    progress = {};
+    frontier = 0;
+    auto interval = std::max<size_t>(budget.interval, 1);
+    window = countdown = budget.invocations < interval ? budget.invocations + 1 : interval;
 }
 
 parser::PContext parser::PContext::next() {
     return PContext{
-            table,
+            session,
             text,
             start_position + accumulator,
             0
     };
 }
 
-parser::ParseTree::ParseTree(const PContext &context, size_t length, std::type_index index, std::vector<TreePtr> subtrees)
-        : parsed_region(context.text.substr(context.start_position, length)), instance(index),
-          subtrees(std::move(subtrees)) {}
+parser::ParseTree::ParseTree(const PContext &context, size_t length, size_t rule, TreeSpan subtrees)
+        : parsed_region(context.text.substr(context.start_position, length)), children(subtrees.first),
+          child_count(subtrees.count), rule(static_cast<uint32_t>(rule)) {}
 
 GRAMMAR_MATCH(Start, {
     auto result =
@@ -34,6 +547,7 @@ GRAMMAR_MATCH(Start, {
 })
 
 GRAMMAR_MATCH(End, {
+    context.session->examine(context.start_position + 1);
     auto result =
             context.start_position == context.text.size() ? MAKE_TREE(0) : nullptr;
     MEMOIZATION(result);
@@ -47,7 +561,8 @@ GRAMMAR_MATCH(Nothing, {
 })
 
 GRAMMAR_MATCH(Any, {
-    if (context.text.size() > context.start_position) {
+    context.session->examine(context.start_position + 1);
+    if (context.text.size() <= context.start_position) {
         MEMOIZATION(nullptr);
         return nullptr;
     }
@@ -57,21 +572,13 @@ GRAMMAR_MATCH(Any, {
 })
 
 void parser::ParseTree::display(std::ostream &out, int count) {
-    std::string indent(count * 4, ' ');
-    static char buffer[512];
-    int status;
-    size_t length = 512;
-    abi::__cxa_demangle(instance.name(), buffer, &length, &status);
-    out << indent << "- " << buffer << ", parsed: \"";
-    escaped_string(out, { parsed_region.begin(), parsed_region.end() });
-    out << "\"" << std::endl;
-    for (const auto &i : subtrees) {
-        i->display(out, count + 1);
-    }
+    TreeWriter(out).text(this, count);
+    out.flush();
 }
 
-parser::ParseTree::ParseTree(std::string_view parsed_region, std::type_index instance, std::vector<TreePtr> subtrees)
-        : parsed_region(parsed_region), instance(instance), subtrees(std::move(subtrees)) {
+parser::ParseTree::ParseTree(std::string_view parsed_region, size_t rule, TreeSpan subtrees)
+        : parsed_region(parsed_region), children(subtrees.first), child_count(subtrees.count),
+          rule(static_cast<uint32_t>(rule)) {
 
 }
 
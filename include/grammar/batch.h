@@ -0,0 +1,169 @@
+//
+// Created by schrodinger on 2/18/21.
+//
+
+#ifndef FRONTEND_BATCH_H
+#define FRONTEND_BATCH_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace parser {
+
+    /*!
+     * The BatchStats class. Throughput and latency of a parse_many call.
+     */
+    struct BatchStats {
+        size_t documents = 0;
+        size_t bytes = 0;
+        /*!
+         * Documents whose root rule did not match.
+         */
+        size_t failures = 0;
+        /*!
+         * Wall time of the batch.
+         */
+        double seconds = 0;
+        double documents_per_second = 0;
+        double megabytes_per_second = 0;
+        /*!
+         * Latency percentiles of a single document, in microseconds.
+         */
+        double p50_us = 0;
+        double p90_us = 0;
+        double p99_us = 0;
+        double max_us = 0;
+    };
+
+    /*!
+     * The ParsePool class. Worker threads that each own a parse session for the lifetime of the pool.
+     * Sessions are reset between documents instead of being rebuilt, so once the memory table, the arena and the
+     * scratch stack of every worker have grown to the largest document, parsing no longer allocates.
+     */
+    class ParsePool {
+        using Task = void (*)(void *, size_t, size_t);
+
+        std::vector<std::shared_ptr<ParseSession>> sessions{};
+        std::vector<std::thread> threads{};
+        std::vector<double> latencies{};
+        std::mutex mutex{};
+        std::condition_variable wake{};
+        std::condition_variable done{};
+        Task task = nullptr;
+        void *context = nullptr;
+        size_t count = 0;
+        std::atomic<size_t> next{0};
+        size_t generation = 0;
+        size_t running = 0;
+        bool stopping = false;
+
+        void work(size_t worker);
+
+        void drain(size_t worker);
+
+        void dispatch(size_t total, Task job, void *state);
+
+    public:
+        /*!
+         * Start a pool.
+         * @param workers number of workers, including the thread calling run(). At least one.
+         */
+        explicit ParsePool(size_t workers = std::thread::hardware_concurrency());
+
+        ParsePool(const ParsePool &) = delete;
+
+        ParsePool &operator=(const ParsePool &) = delete;
+
+        ~ParsePool();
+
+        /*!
+         * @return number of workers.
+         */
+        [[nodiscard]] size_t size() const {
+            return sessions.size();
+        }
+
+        /*!
+         * @param worker worker index.
+         * @return the session of a worker.
+         */
+        [[nodiscard]] const std::shared_ptr<ParseSession> &session(size_t worker) const {
+            return sessions[worker];
+        }
+
+        /*!
+         * Run a job for every index below a count, spread over the workers, and wait for all of them.
+         * Only one run may be active at a time.
+         * @tparam Job callable taking the worker index and the job index.
+         * @param total number of job indices.
+         * @param job job to run.
+         */
+        template<class Job>
+        void run(size_t total, Job &job) {
+            dispatch(total, [](void *state, size_t worker, size_t index) {
+                (*static_cast<Job *>(state))(worker, index);
+            }, &job);
+        }
+
+        /*!
+         * Get a buffer for per-document latencies, grown when needed and kept between batches.
+         * @param total number of documents.
+         * @return the buffer.
+         */
+        double *latency_buffer(size_t total);
+
+        /*!
+         * Summarize a batch whose latencies are in the latency buffer. Reorders the buffer.
+         * @param total number of documents.
+         * @param bytes total input size.
+         * @param failures number of failed documents.
+         * @param seconds wall time.
+         * @return the statistics.
+         */
+        BatchStats summarize(size_t total, size_t bytes, size_t failures, double seconds);
+    };
+
+    /*!
+     * Parse many independent documents on a pool. Each worker resets its own session before every document, so a
+     * warm pool parses without allocating.
+     * @tparam Rule root grammar rule.
+     * @tparam Callback callable taking the document index and the tree, nullptr if the document does not match.
+     * @param pool worker pool.
+     * @param documents source inputs.
+     * @param callback called on the worker thread right after each parse. The tree is only valid during the
+     * call, and calls for different documents may run concurrently.
+     * @return throughput and latency statistics.
+     */
+    template<class Rule, class Callback>
+    BatchStats parse_many(ParsePool &pool, const std::vector<std::string_view> &documents, Callback &&callback) {
+        using Clock = std::chrono::steady_clock;
+        auto latencies = pool.latency_buffer(documents.size());
+        std::atomic<size_t> failures{0};
+        auto job = [&](size_t worker, size_t index) {
+            auto &session = pool.session(worker);
+            auto start = Clock::now();
+            session->reset();
+            auto tree = Rule().match(PContext{session, documents[index], 0, 0});
+            latencies[index] = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+            if (!tree) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+            }
+            callback(index, tree);
+        };
+        auto start = Clock::now();
+        pool.run(documents.size(), job);
+        auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        size_t bytes = 0;
+        for (auto i : documents) {
+            bytes += i.size();
+        }
+        return pool.summarize(documents.size(), bytes, failures.load(), seconds);
+    }
+}
+
+#endif //FRONTEND_BATCH_H
@@ -0,0 +1,201 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#ifndef FRONTEND_CACHE_H
+#define FRONTEND_CACHE_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+#include "flat.h"
+#include <mutex>
+
+namespace parser {
+
+    /*!
+     * The FingerprintBuilder class. Collects the structure of every rule reachable from a set of rules: its name,
+     * its memo policy and the type of its definition, which spells out the anonymous combinators and the names of
+     * the rules it uses.
+     */
+    class FingerprintBuilder {
+        /*!
+         * Rules already added, by rule id.
+         */
+        std::vector<bool> seen{};
+        std::string structure{};
+
+        template<class D>
+        struct Walk {
+            static void visit(FingerprintBuilder &) {}
+        };
+
+        template<template<class...> class Combinator, class ...Rules>
+        struct Walk<Combinator<Rules...>> {
+            static void visit(FingerprintBuilder &builder) {
+                (builder.rule<Rules>(), ...);
+            }
+        };
+
+    public:
+        /*!
+         * Add a rule and the rules it uses.
+         * @tparam T grammar rule.
+         */
+        template<class T>
+        void rule() {
+            auto id = rule_id<T>();
+            if (id >= seen.size()) {
+                seen.resize(id + 1);
+            }
+            if (seen[id]) {
+                return;
+            }
+            seen[id] = true;
+            structure += rule_name<T>();
+            structure += T::memo_policy::value ? '=' : '~';
+            structure += rule_name<typename T::definition>();
+            structure += '\n';
+            Walk<typename T::definition>::visit(*this);
+        }
+
+        /*!
+         * @return hash of the structure collected so far.
+         */
+        [[nodiscard]] uint64_t hash() const {
+            return content_hash(structure);
+        }
+    };
+
+    template<class ...Rules>
+    struct Fingerprint {
+        static uint64_t value() {
+            FingerprintBuilder builder;
+            (builder.rule<Rules>(), ...);
+            return builder.hash();
+        }
+    };
+
+    template<class ...Rules>
+    struct Fingerprint<Selector<Rules...>> : Fingerprint<Rules...> {
+    };
+
+    /*!
+     * Fingerprint a grammar, so that trees cached by one version of it are not read by another.
+     * @tparam Rules root rules, or a single Selector whose rule set is used.
+     * @return hash of the structure of every rule reachable from the roots, computed on first use.
+     */
+    template<class ...Rules>
+    uint64_t grammar_fingerprint() {
+        static const uint64_t fingerprint = Fingerprint<Rules...>::value();
+        return fingerprint;
+    }
+
+    /*!
+     * The ParseCache class. A directory of flat trees keyed by the content hash of their source and by a grammar
+     * fingerprint, shared by concurrent processes. Entries are written to a temporary file and renamed into place,
+     * so readers only ever see complete files; a reader keeps its mapping even if the entry is replaced or evicted.
+     * Hits refresh the modification time of the entry, and eviction removes the least recently used entries once
+     * the directory exceeds its capacity.
+     *
+     * Stores keep a running estimate of the cache size in a ledger file, to which every process appends the size of
+     * the entries it stores and every eviction appends the size it found, so that the directory is only scanned
+     * when the estimate exceeds the capacity.
+     */
+    class ParseCache {
+        std::string directory;
+        uint64_t fingerprint;
+        uint64_t capacity;
+
+        /*!
+         * Part of the ledger read by this process: the file it was read from, and the estimate up to the offset.
+         */
+        struct Ledger {
+            uint64_t inode = 0;
+            uint64_t offset = 0;
+            uint64_t estimate = 0;
+            bool known = false;
+        };
+        mutable std::mutex mutex{};
+        mutable Ledger ledger{};
+
+        /*!
+         * Append the size of a stored entry to the ledger and catch up with the records of other processes.
+         * @param size size of the entry.
+         * @return whether the cache may exceed its capacity.
+         */
+        bool account(uint64_t size) const;
+
+    public:
+        /*!
+         * Create a cache.
+         * @param directory cache directory, created by open().
+         * @param fingerprint grammar fingerprint, usually from grammar_fingerprint.
+         * @param capacity size in bytes above which stores evict old entries.
+         */
+        ParseCache(std::string directory, uint64_t fingerprint, uint64_t capacity = uint64_t{1} << 30u)
+                : directory(std::move(directory)), fingerprint(fingerprint), capacity(capacity) {}
+
+        /*!
+         * Create the cache directory if needed.
+         * @return whether the directory exists.
+         */
+        bool open() const;
+
+        /*!
+         * @param text source input.
+         * @return path of the entry of a source.
+         */
+        [[nodiscard]] std::string path(std::string_view text) const;
+
+        /*!
+         * Look a source up.
+         * @param text source input.
+         * @param tree receives the mapped tree on a hit.
+         * @return whether the cache holds a tree parsed from this source by this grammar.
+         */
+        bool find(std::string_view text, FlatTree &tree) const;
+
+        /*!
+         * Store a flat tree, then evict if the running size estimate is over capacity.
+         * @param text source input the tree was parsed from.
+         * @param bytes serialized tree, from flatten.
+         * @param tree receives the stored tree, mapped before the entry is published so that eviction by another
+         * process cannot take it away.
+         * @return whether the entry was written.
+         */
+        bool store(std::string_view text, std::string_view bytes, FlatTree &tree) const;
+
+        /*!
+         * If the cache exceeds its capacity, remove the least recently used entries until it fits in seven eighths
+         * of it. Record the size left in the ledger.
+         * @return bytes left in the cache.
+         */
+        uint64_t evict() const;
+    };
+
+    /*!
+     * Parse a source through a cache: a hit maps the stored tree without running the grammar, and a miss parses,
+     * stores the flat tree and maps it.
+     * @tparam Rule root grammar rule, which the fingerprint of the cache must cover.
+     * @param cache parse cache.
+     * @param text source input.
+     * @param source_name name of the source, stored in the tree.
+     * @param tree receives the mapped tree.
+     * @return whether the tree is available: false if the root rule does not match, or if a missed tree cannot be
+     * written to the cache.
+     */
+    template<class Rule>
+    bool parse_cached(const ParseCache &cache, std::string_view text, std::string_view source_name, FlatTree &tree) {
+        if (cache.find(text, tree)) {
+            return true;
+        }
+        auto session = std::make_shared<ParseSession>();
+        auto result = Rule().match(PContext{session, text, 0, 0});
+        if (!result) {
+            return false;
+        }
+        return cache.store(text, flatten(result, text, source_name), tree);
+    }
+}
+
+#endif //FRONTEND_CACHE_H
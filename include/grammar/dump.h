@@ -0,0 +1,77 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#ifndef FRONTEND_DUMP_H
+#define FRONTEND_DUMP_H
+
+#include "grammar.h"
+
+namespace parser {
+
+    /*!
+     * The TreeWriter class. Prints trees through a buffer that is handed to the stream in large blocks. Rule names
+     * are looked up in the registry once per rule and kept by the writer, and trees are walked with an explicit
+     * stack, so that any tree the parser can build can be printed.
+     */
+    class TreeWriter {
+        std::ostream &out;
+        std::string buffer{};
+        /*!
+         * Names of the rules seen so far, by rule id; empty for rules not seen yet.
+         */
+        std::vector<std::string_view> names{};
+        std::vector<std::pair<TreePtr, size_t>> stack{};
+
+        std::string_view name(size_t rule);
+
+        void escape(std::string_view text);
+
+        void json_escape(std::string_view text);
+
+        void number(size_t value);
+
+        void reserve();
+
+    public:
+        /*!
+         * Buffer size above which the writer hands its buffer to the stream.
+         */
+        static constexpr size_t block = 1u << 16u;
+
+        explicit TreeWriter(std::ostream &out) : out(out) {
+            buffer.reserve(block + 1024);
+        }
+
+        TreeWriter(const TreeWriter &) = delete;
+
+        TreeWriter &operator=(const TreeWriter &) = delete;
+
+        ~TreeWriter() {
+            flush();
+        }
+
+        /*!
+         * Print a tree in the format of ParseTree::display: one node per line, as its rule name and its escaped
+         * parsed region, indented by four spaces per level.
+         * @param tree tree to print; nullptr prints nothing.
+         * @param depth indentation level of the root.
+         */
+        void text(TreePtr tree, int depth = 0);
+
+        /*!
+         * Print a tree as a JSON object: `rule`, `offset` and `length` for every node, `text` for leaves, and
+         * `children` for inner nodes.
+         * @param tree tree to print; nullptr prints `null`.
+         * @param source source input the tree regions point into, from which offsets are counted.
+         */
+        void json(TreePtr tree, std::string_view source);
+
+        /*!
+         * Hand the buffered output to the stream.
+         */
+        void flush();
+    };
+}
+
+#endif //FRONTEND_DUMP_H
@@ -0,0 +1,289 @@
+//
+// Created by schrodinger on 2/15/21.
+//
+
+#ifndef FRONTEND_EVENTS_H
+#define FRONTEND_EVENTS_H
+
+#include "select.h"
+
+namespace parser {
+
+    /*!
+     * The PendingEvent class. A selected rule matched by an event parse whose events are not emitted yet.
+     * Records are kept in preorder; a record that is still being matched has length no_match.
+     */
+    struct PendingEvent {
+        /*!
+         * Rule type.
+         */
+        std::type_index rule;
+        /*!
+         * Start of the matched region.
+         */
+        size_t offset;
+        /*!
+         * Length of the matched region.
+         */
+        size_t length;
+        /*!
+         * Number of records below this one.
+         */
+        size_t descendants;
+    };
+
+    /*!
+     * The EventTable class. Packrat memory of an event parse. Each entry keeps the match length and a copy of the
+     * pending events of the match, which are replayed on a hit.
+     */
+    class EventTable {
+        struct Entry {
+            /*!
+             * 0 for unknown entries, 1 for failures and length + 2 for successes.
+             */
+            uint32_t state;
+            uint32_t begin;
+            uint32_t count;
+        };
+
+        std::vector<std::vector<Entry>> columns{};
+        std::vector<PendingEvent> pool{};
+        size_t base = 0;
+    public:
+        /*!
+         * Look up a memoized match.
+         * @param key memoization key.
+         * @param length receives the memoized length, or no_match for a memoized failure.
+         * @param events receives the events of a memoized success.
+         * @return whether the key is present.
+         */
+        bool find(const MemoKey &key, size_t &length, std::vector<PendingEvent> &events) const {
+            if (key.second >= columns.size() || key.first < base) {
+                return false;
+            }
+            auto &column = columns[key.second];
+            auto index = key.first - base;
+            if (index >= column.size() || !column[index].state) {
+                return false;
+            }
+            auto &entry = column[index];
+            length = entry.state == 1 ? no_match : entry.state - 2;
+            events.insert(events.end(), pool.begin() + entry.begin, pool.begin() + entry.begin + entry.count);
+            return true;
+        }
+
+        /*!
+         * Memoize a match.
+         * @param key memoization key.
+         * @param length matched length, or no_match for a failure.
+         * @param first first event of the match.
+         * @param last end of the events of the match.
+         */
+        void insert(const MemoKey &key, size_t length, const PendingEvent *first, const PendingEvent *last);
+
+        /*!
+         * Drop all entries and ignore every position before a cut from now on.
+         * @param position cut position.
+         */
+        void retire(size_t position);
+    };
+
+    /*!
+     * The Emitter class. State of a parse that reports the selected rules to a visitor instead of building a tree.
+     * A selected rule is reported as enter(rule, position) when it starts and exit(rule, region) when it has
+     * matched, nested in document order.
+     * Events are buffered while a match can still be undone, so nothing is reported for alternatives that fail.
+     * The buffer is flushed at every cut declared with Commit, and at the end of the parse: rules that are still
+     * being matched at a cut are entered then and exited as soon as they match. A commit is final, so a rule that
+     * was entered before a cut and fails afterwards is not exited.
+     * @tparam S selector; `S::selects<T>()` tells at compile time whether rule T is reported.
+     * @tparam V visitor with `enter(std::type_index, size_t)` and `exit(std::type_index, std::string_view)`.
+     */
+    template<class S, class V>
+    struct Emitter {
+        using selector = S;
+
+        /*!
+         * Source input.
+         */
+        std::string_view text;
+        /*!
+         * Event consumer.
+         */
+        V &visitor;
+        /*!
+         * Memory table.
+         */
+        EventTable table{};
+        /*!
+         * Pending events; the record at index i has the logical index base + i.
+         */
+        std::vector<PendingEvent> events{};
+        /*!
+         * Number of events flushed so far.
+         */
+        size_t base = 0;
+        /*!
+         * Session for the rules of unknown kind, created on first use.
+         */
+        std::shared_ptr<ParseSession> fallback{};
+        /*!
+         * Flushed records waiting for their exit event, with the index after their last descendant.
+         */
+        std::vector<std::pair<size_t, const PendingEvent *>> closing{};
+
+        Emitter(std::string_view text, V &visitor) : text(text), visitor(visitor) {}
+
+        /*!
+         * Match a rule, going through the memory table according to its memo_policy. On success the events of
+         * the rule are pending or, after a cut inside it, emitted.
+         * @tparam T grammar rule.
+         * @param position start position.
+         * @return matched length, or no_match.
+         */
+        template<class T>
+        size_t match(size_t position);
+
+        /*!
+         * @return a mark to rewind the events produced from now on.
+         */
+        [[nodiscard]] size_t mark() const {
+            return base + events.size();
+        }
+
+        /*!
+         * Drop the pending events produced since a mark. Emitted events stay emitted.
+         * @param mark value returned by mark().
+         */
+        void rewind(size_t mark) {
+            events.erase(events.begin() + static_cast<ptrdiff_t>(std::max(mark, base) - base), events.end());
+        }
+
+        /*!
+         * Handle a cut declared with Commit: nothing before it can be undone any more.
+         * @param position cut position.
+         */
+        void cut(size_t position) {
+            table.retire(position);
+            flush();
+        }
+
+        /*!
+         * Add the selected rules of a tree parsed by a virtual match function as pending events.
+         * @param tree matched tree.
+         */
+        void splice(TreePtr tree) {
+            for (auto i : tree->subtrees()) {
+                for (auto j : i->template compress<S>(fallback->arena)) {
+                    record(j);
+                }
+            }
+        }
+
+        /*!
+         * Emit all pending events.
+         */
+        void flush();
+
+    private:
+        void record(TreePtr tree) {
+            auto index = events.size();
+            events.push_back({rule_type(tree->rule), static_cast<size_t>(tree->parsed_region.data() - text.data()),
+                              tree->parsed_region.size(), 0});
+            for (auto i : tree->subtrees()) {
+                record(i);
+            }
+            events[index].descendants = events.size() - index - 1;
+        }
+    };
+
+    template<class S, class V>
+    template<class T>
+    size_t Emitter<S, V>::match(size_t position) {
+        constexpr bool memoized = T::memo_policy::value;
+        constexpr bool selected = S::template selects<T>();
+        MemoKey key{position, rule_id<T>()};
+        size_t length;
+        if constexpr (memoized) {
+            if (table.find(key, length, events)) {
+                return length;
+            }
+        }
+        auto start = mark();
+        if constexpr (selected) {
+            events.push_back({typeid(T), position, no_match, 0});
+        }
+        length = Build<definition_t<T>>::template match<T>(*this, position);
+        if (length == no_match) {
+            rewind(start);
+            if constexpr (memoized) {
+                table.insert(key, no_match, nullptr, nullptr);
+            }
+            return no_match;
+        }
+        if (start < base) {
+            // entered at a cut: everything below it is final
+            if constexpr (selected) {
+                flush();
+                visitor.exit(typeid(T), text.substr(position, length));
+            }
+            return length;
+        }
+        auto first = events.data() + (start - base);
+        if constexpr (selected) {
+            first->length = length;
+            first->descendants = events.size() - (start - base) - 1;
+        }
+        if constexpr (memoized) {
+            table.insert(key, length, first, events.data() + events.size());
+        }
+        return length;
+    }
+
+    template<class S, class V>
+    void Emitter<S, V>::flush() {
+        for (size_t i = 0; i < events.size(); ++i) {
+            while (!closing.empty() && closing.back().first <= i) {
+                auto event = closing.back().second;
+                visitor.exit(event->rule, text.substr(event->offset, event->length));
+                closing.pop_back();
+            }
+            auto &event = events[i];
+            visitor.enter(event.rule, event.offset);
+            if (event.length != no_match) {
+                closing.emplace_back(i + 1 + event.descendants, &event);
+            }
+        }
+        while (!closing.empty()) {
+            auto event = closing.back().second;
+            visitor.exit(event->rule, text.substr(event->offset, event->length));
+            closing.pop_back();
+        }
+        base += events.size();
+        events.clear();
+    }
+
+    /*!
+     * Parse a text in one streaming pass, reporting the rules active in a selector to a visitor instead of
+     * building a tree. Events of a statement are emitted at the cut that ends it, so memory stays bounded by the
+     * largest committed unit.
+     * @tparam Rule root grammar rule.
+     * @tparam S selector marking the reported rules.
+     * @tparam V visitor type.
+     * @param text source input.
+     * @param visitor receives enter(std::type_index rule, size_t position) and
+     * exit(std::type_index rule, std::string_view region).
+     * @return matched length, or no_match. Events of a failed parse that were not committed are not emitted.
+     */
+    template<class Rule, class S, class V>
+    size_t parse_events(std::string_view text, V &visitor) {
+        Emitter<S, V> emitter{text, visitor};
+        auto length = emitter.template match<Rule>(0);
+        if (length != no_match) {
+            emitter.flush();
+        }
+        return length;
+    }
+}
+
+#endif //FRONTEND_EVENTS_H
@@ -0,0 +1,299 @@
+//
+// Created by schrodinger on 2/14/21.
+//
+
+#ifndef FRONTEND_FLAT_H
+#define FRONTEND_FLAT_H
+
+#include "grammar.h"
+#include "stream.h"
+
+namespace parser {
+
+    /*!
+     * The FlatHeader class. Header of a flat tree file. All integers are in host byte order, which the reader
+     * checks through the byte order mark.
+     */
+    struct FlatHeader {
+        char magic[8];
+        uint32_t byte_order;
+        uint32_t version;
+        uint64_t file_size;
+        uint64_t node_count;
+        uint64_t nodes_offset;
+        uint64_t rule_count;
+        uint64_t names_offset;
+        uint64_t source_offset;
+        uint64_t source_name_size;
+        uint64_t source_size;
+        uint64_t source_hash;
+    };
+
+    /*!
+     * The FlatNode class. A tree node of a flat tree file. Nodes are stored in preorder.
+     */
+    struct FlatNode {
+        /*!
+         * Start of the parsed region in the source.
+         */
+        uint64_t offset;
+        /*!
+         * Length of the parsed region.
+         */
+        uint64_t length;
+        /*!
+         * Index into the rule name table.
+         */
+        uint32_t rule;
+        /*!
+         * Number of direct subtrees.
+         */
+        uint32_t children;
+        /*!
+         * Number of nodes below this one, so that the next sibling is found without walking the subtree.
+         */
+        uint64_t descendants;
+    };
+
+    /*!
+     * Hash a text with 64-bit FNV-1a, to check that a source matches what a tree was parsed from.
+     * @param text content.
+     * @return content hash.
+     */
+    uint64_t content_hash(std::string_view text);
+
+    /*!
+     * Serialize a tree into the flat format: a header, the preorder node array, the rule name table and a
+     * reference to the source (its name, size and content hash).
+     * @param tree tree parsed from text; nullptr is not allowed.
+     * @param text source input the tree regions point into.
+     * @param source_name name of the source, usually its path.
+     * @return the serialized bytes.
+     */
+    std::string flatten(TreePtr tree, std::string_view text, std::string_view source_name);
+
+    /*!
+     * Serialize a tree into a flat tree file.
+     * @param path output file path.
+     * @param tree tree parsed from text.
+     * @param text source input the tree regions point into.
+     * @param source_name name of the source, usually its path.
+     * @return whether the file was written.
+     */
+    bool write_flat(const std::string &path, TreePtr tree, std::string_view text, std::string_view source_name);
+
+    class FlatTree;
+
+    /*!
+     * The FlatCursor class. A position in a flat tree.
+     */
+    class FlatCursor {
+        const FlatTree *tree = nullptr;
+        size_t index = 0;
+        size_t end = 0;
+
+    public:
+        FlatCursor() = default;
+
+        /*!
+         * Create a cursor.
+         * @param tree flat tree.
+         * @param index node index.
+         * @param end index after the last sibling of the node.
+         */
+        FlatCursor(const FlatTree *tree, size_t index, size_t end) : tree(tree), index(index), end(end) {}
+
+        /*!
+         * @return whether the cursor points at a node.
+         */
+        [[nodiscard]] bool valid() const {
+            return tree && index < end;
+        }
+
+        /*!
+         * @return the current node record.
+         */
+        [[nodiscard]] const FlatNode &node() const;
+
+        /*!
+         * @return preorder index of the current node.
+         */
+        [[nodiscard]] size_t position() const {
+            return index;
+        }
+
+        /*!
+         * @return rule name of the current node.
+         */
+        [[nodiscard]] std::string_view rule() const;
+
+        /*!
+         * Get the parsed region of the current node.
+         * @param source the source input, which must match the reference of the tree.
+         * @return the parsed region.
+         */
+        [[nodiscard]] std::string_view region(std::string_view source) const {
+            return source.substr(node().offset, node().length);
+        }
+
+        /*!
+         * @return cursor at the first subtree, invalid if there is none.
+         */
+        [[nodiscard]] FlatCursor first_child() const;
+
+        /*!
+         * @return cursor at the next sibling, invalid if there is none.
+         */
+        [[nodiscard]] FlatCursor next_sibling() const;
+
+        bool operator==(const FlatCursor &that) const {
+            return index == that.index && tree == that.tree;
+        }
+
+        bool operator!=(const FlatCursor &that) const {
+            return !(*this == that);
+        }
+
+        /*!
+         * @return range over the subtrees of the current node.
+         */
+        [[nodiscard]] struct FlatChildren subtrees() const;
+    };
+
+    /*!
+     * The FlatIterator class. Walks the siblings from a cursor.
+     */
+    class FlatIterator {
+        FlatCursor cursor;
+    public:
+        explicit FlatIterator(FlatCursor cursor) : cursor(cursor) {}
+
+        const FlatCursor &operator*() const { return cursor; }
+
+        const FlatCursor *operator->() const { return &cursor; }
+
+        FlatIterator &operator++() {
+            cursor = cursor.next_sibling();
+            return *this;
+        }
+
+        bool operator==(const FlatIterator &that) const {
+            return cursor.valid() == that.cursor.valid() && (!cursor.valid() || cursor == that.cursor);
+        }
+
+        bool operator!=(const FlatIterator &that) const { return !(*this == that); }
+    };
+
+    /*!
+     * The FlatChildren class. Range over the subtrees of a node.
+     */
+    struct FlatChildren {
+        FlatCursor first;
+
+        [[nodiscard]] FlatIterator begin() const { return FlatIterator{first}; }
+
+        [[nodiscard]] FlatIterator end() const { return FlatIterator{FlatCursor{}}; }
+    };
+
+    inline FlatChildren FlatCursor::subtrees() const {
+        return {first_child()};
+    }
+
+    /*!
+     * The FlatTree class. A flat tree read in place, either from a memory mapping or from bytes owned by the
+     * caller. Nothing is copied or decoded: cursors point straight into the stored node array.
+     */
+    class FlatTree {
+        friend class FlatCursor;
+
+        MappedFile file{};
+        const FlatHeader *header = nullptr;
+        const FlatNode *nodes = nullptr;
+        const uint64_t *names = nullptr;
+        const char *base = nullptr;
+
+    public:
+        /*!
+         * Map a flat tree file.
+         * @param path file path.
+         * @return whether the file is a valid flat tree.
+         */
+        bool open(const std::string &path);
+
+        /*!
+         * Read a flat tree from bytes, which must outlive the tree and be 8-byte aligned.
+         * @param bytes serialized tree.
+         * @return whether the bytes are a valid flat tree.
+         */
+        bool load(std::string_view bytes);
+
+        /*!
+         * @return number of nodes.
+         */
+        [[nodiscard]] size_t size() const {
+            return header ? header->node_count : 0;
+        }
+
+        /*!
+         * @return preorder node array.
+         */
+        [[nodiscard]] const FlatNode *data() const {
+            return nodes;
+        }
+
+        /*!
+         * @return number of rule names.
+         */
+        [[nodiscard]] size_t rules() const {
+            return header ? header->rule_count : 0;
+        }
+
+        /*!
+         * Get a rule name.
+         * @param rule index into the rule name table.
+         * @return demangled rule name.
+         */
+        [[nodiscard]] std::string_view rule_name(size_t rule) const {
+            return {base + names[rule], names[rule + 1] - names[rule]};
+        }
+
+        /*!
+         * @return name of the source the tree was parsed from.
+         */
+        [[nodiscard]] std::string_view source_name() const {
+            return header ? std::string_view{base + header->source_offset, header->source_name_size} : "";
+        }
+
+        /*!
+         * @return content hash of the source the tree was parsed from.
+         */
+        [[nodiscard]] uint64_t source_hash() const {
+            return header ? header->source_hash : 0;
+        }
+
+        /*!
+         * @return size of the source the tree was parsed from.
+         */
+        [[nodiscard]] size_t source_size() const {
+            return header ? header->source_size : 0;
+        }
+
+        /*!
+         * Check that a text is the source the tree was parsed from.
+         * @param source candidate source.
+         * @return whether its size and content hash match.
+         */
+        [[nodiscard]] bool matches(std::string_view source) const {
+            return header && source.size() == header->source_size && content_hash(source) == header->source_hash;
+        }
+
+        /*!
+         * @return cursor at the root node, invalid for an empty tree.
+         */
+        [[nodiscard]] FlatCursor root() const {
+            return {this, 0, size()};
+        }
+    };
+}
+
+#endif //FRONTEND_FLAT_H
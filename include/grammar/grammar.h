@@ -13,34 +13,664 @@
 #include <string>
 #include <ostream>
 #include <cstring>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <functional>
+#include <chrono>
+#include "profile.h"
 
 namespace parser {
     struct PContext;
 
 
-    using MemoKey = std::pair<size_t, std::type_index>;
-    using TreePtr = std::shared_ptr<struct ParseTree>;
+    using MemoKey = std::pair<size_t, size_t>;
+    using TreePtr = struct ParseTree *;
 
     /*!
-     * The MemoKeyHasher class. Used to generate the hash value of memo key.
+     * Length returned by the tree-less engines for a failed match.
      */
-    struct MemoKeyHasher {
-        size_t operator()(const MemoKey &key) const;
+    constexpr size_t no_match = static_cast<size_t>(-1);
+
+    /*!
+     * The TreeSpan class. A contiguous run of subtree pointers stored in a tree arena.
+     */
+    struct TreeSpan {
+        TreePtr *first = nullptr;
+        uint32_t count = 0;
+
+        [[nodiscard]] TreePtr *begin() const { return first; }
+
+        [[nodiscard]] TreePtr *end() const { return first + count; }
+
+        [[nodiscard]] size_t size() const { return count; }
+
+        [[nodiscard]] bool empty() const { return count == 0; }
+
+        TreePtr operator[](size_t index) const { return first[index]; }
+    };
+
+    /*!
+     * Get the dense integer id of a grammar rule type.
+     * Ids are assigned in first-use order and are stable for the lifetime of the process.
+     * @param index grammar rule type info.
+     * @return rule id.
+     */
+    size_t rule_id(std::type_index index);
+
+    /*!
+     * Get the dense integer id of a grammar rule type, registering the type under a name if it is new.
+     * @param index grammar rule type info.
+     * @param name readable name of the type, with static storage.
+     * @return rule id.
+     */
+    size_t rule_id(std::type_index index, std::string_view name);
+
+    /*!
+     * Get the readable name of a type at compile time, cut out of the signature of this function as the compiler
+     * spells it.
+     * @tparam T type.
+     * @return type name, with static storage.
+     */
+    template<class T>
+    constexpr std::string_view rule_name() {
+        std::string_view signature = __PRETTY_FUNCTION__;
+        auto start = signature.find("T = ") + 4;
+        auto end = signature.find(';', start);
+        if (end == std::string_view::npos) {
+            end = signature.rfind(']');
+        }
+        return signature.substr(start, end - start);
+    }
+
+    /*!
+     * Get the dense integer id of a grammar rule type, cached per type.
+     * @tparam T grammar rule type.
+     * @return rule id.
+     */
+    template<class T>
+    size_t rule_id() {
+        static const size_t id = rule_id(typeid(T), rule_name<T>());
+        return id;
+    }
+
+    /*!
+     * Get the name registered under a rule id: the compile-time name for rules seen through rule_id<T>, the
+     * demangled name for the others.
+     * @param id rule id returned by rule_id.
+     * @return rule name, valid for the lifetime of the process, or an empty string for an unknown id.
+     */
+    std::string_view rule_name(size_t id);
+
+    /*!
+     * Get the grammar rule type registered under a rule id.
+     * @param id rule id returned by rule_id.
+     * @return rule type info.
+     */
+    std::type_index rule_type(size_t id);
+
+    /*!
+     * Get the readable name of a type.
+     * @param index type info.
+     * @return demangled type name.
+     */
+    std::string demangle(std::type_index index);
+
+    /*!
+     * The MemoSlot class. A successful match recorded in the memory table.
+     */
+    struct MemoSlot {
+        /*!
+         * Parsed length.
+         */
+        size_t length;
+        /*!
+         * Parsed tree node.
+         */
+        TreePtr tree;
+    };
+
+    /*!
+     * The MemoTable class. Packrat memory with one dense column per grammar rule id.
+     * Each column is indexed by position: failures are kept in a bitmap, successes as an index into a compact
+     * slot array. A shared column records, for every position, how far the entries memoized there looked ahead.
+     * Positions are stored at their distance to the base until the first edit; edits then map positions to storage
+     * indices through segments, so that they never move the columns.
+     */
+    class MemoTable {
+        struct Column {
+            std::vector<uint64_t> failed{};
+            std::vector<uint32_t> success{};
+        };
+
+        /*!
+         * A run of positions stored at consecutive indices, from `position` up to the next segment.
+         */
+        struct Segment {
+            size_t position;
+            size_t index;
+        };
+
+        std::vector<Column> columns{};
+        std::vector<MemoSlot> slots{};
+        std::vector<uint32_t> reaches{};
+        /*!
+         * Position map, sorted by position; empty until the first edit.
+         */
+        std::vector<Segment> segments{};
+        /*!
+         * Max tree over blocks of storage indices, of the index plus the reach stored there. Kept from the first
+         * edit on, so that an edit finds the entries that looked across it without scanning the table.
+         */
+        std::vector<size_t> ends{};
+        static constexpr size_t block_size = 64;
+        size_t successes = 0;
+        size_t failures = 0;
+        size_t base = 0;
+        /*!
+         * First storage index that no position maps to.
+         */
+        size_t extent = 0;
+
+        [[nodiscard]] size_t index(size_t position) const {
+            if (segments.empty()) {
+                return position - base;
+            }
+            auto next = std::upper_bound(segments.begin(), segments.end(), position,
+                                         [](size_t p, const Segment &segment) { return p < segment.position; });
+            auto &segment = *(next - 1);
+            return segment.index + (position - segment.position);
+        }
+
+        [[nodiscard]] size_t block_end(size_t block) const;
+
+        void track(size_t index, bool raised);
+
+        void rebuild(size_t count);
+
+        void crossing(size_t low, size_t high, size_t threshold, std::vector<size_t> &found) const;
+
+        void drop(size_t index);
+
+        void discard(size_t low, size_t high);
+
+    public:
+        /*!
+         * The slot returned for memoized failures.
+         */
+        static const MemoSlot failure;
+
+        /*!
+         * Look up a memoized result.
+         * @param key memoization key.
+         * @return the memoized slot, `&failure` for a memoized failure, or nullptr if the key is absent.
+         */
+        [[nodiscard]] const MemoSlot *find(const MemoKey &key) const {
+            if (key.second >= columns.size() || key.first < base) {
+                return nullptr;
+            }
+            auto &column = columns[key.second];
+            auto index = this->index(key.first);
+            if (index < column.success.size() && column.success[index]) {
+                return &slots[column.success[index] - 1];
+            }
+            if ((index >> 6u) < column.failed.size() &&
+                (column.failed[index >> 6u] >> (index & 63u) & 1u)) {
+                return &failure;
+            }
+            return nullptr;
+        }
+
+        /*!
+         * Memoize a result. An existing entry for the same key is kept.
+         * @param key memoization key.
+         * @param tree parsed tree, or nullptr for a failure.
+         * @param reach end of the input examined to compute the result, exclusive. Defaults to the position.
+         */
+        void insert(const MemoKey &key, TreePtr tree, size_t reach = 0);
+
+        /*!
+         * Get how far the entries memoized at a position looked ahead.
+         * @param position memoized position.
+         * @return end of the examined input, exclusive.
+         */
+        [[nodiscard]] size_t reach(size_t position) const {
+            if (position < base) {
+                return position;
+            }
+            auto index = this->index(position);
+            return index < reaches.size() ? position + reaches[index] : position;
+        }
+
+        /*!
+         * Adjust the table to an edit of the input. Entries that examined the edited range are dropped; entries
+         * after it are moved to their new positions. Takes time in the number of dropped entries and of edits
+         * since the table was last cleared, not in the size of the input.
+         * @param offset edit position.
+         * @param removed number of removed bytes.
+         * @param inserted number of inserted bytes.
+         * @param size length of the input before the edit.
+         */
+        void edit(size_t offset, size_t removed, size_t inserted, size_t size);
+
+        /*!
+         * @return number of memoized entries.
+         */
+        [[nodiscard]] size_t size() const;
+
+        /*!
+         * @return bytes reserved by the columns and slots.
+         */
+        [[nodiscard]] size_t bytes() const;
+
+        /*!
+         * Drop all entries.
+         */
+        void clear();
+
+        /*!
+         * Drop all entries and ignore every position before a cut from now on.
+         * Columns restart at the cut, so their size stays bounded by the distance parsed since the last cut.
+         * @param position cut position.
+         */
+        void retire(size_t position);
+
+        /*!
+         * Drop all entries but keep the storage of the columns, for a new parse of the same grammar.
+         */
+        void reset();
+    };
+
+    /*!
+     * The TreeArena class. A bump allocator owning every tree node of a parse session.
+     * Nodes are never freed individually; the arena releases its chunks all at once.
+     */
+    class TreeArena {
+        struct Chunk {
+            Chunk *next;
+            size_t capacity;
+        };
+
+        Chunk *head = nullptr;
+        Chunk *spare = nullptr;
+        Chunk *adopted = nullptr;
+        uintptr_t cursor = 0;
+        uintptr_t limit = 0;
+        size_t used = 0;
+        size_t reserved = 0;
+        size_t chunk_count = 0;
+
+        void grow(size_t bytes);
+
+    public:
+        /*!
+         * A position in the arena, used to release everything allocated after it.
+         */
+        struct Mark {
+            Chunk *chunk;
+            uintptr_t cursor;
+            size_t used;
+        };
+
+        TreeArena() = default;
+
+        TreeArena(const TreeArena &) = delete;
+
+        TreeArena &operator=(const TreeArena &) = delete;
+
+        ~TreeArena();
+
+        /*!
+         * Allocate raw memory from the arena.
+         * @param bytes requested size.
+         * @param align requested alignment.
+         * @return the allocated memory.
+         */
+        void *allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+            auto address = (cursor + align - 1) & ~(align - 1);
+            if (address + bytes > limit) {
+                grow(bytes + align);
+                address = (cursor + align - 1) & ~(align - 1);
+            }
+            cursor = address + bytes;
+            used += bytes;
+            return reinterpret_cast<void *>(address);
+        }
+
+        /*!
+         * Copy subtree pointers into the arena. Aborts if the count does not fit in 32 bits.
+         * @param first first subtree.
+         * @param count number of subtrees.
+         * @return the stored span.
+         */
+        TreeSpan span(const TreePtr *first, size_t count);
+
+        TreeSpan span(std::initializer_list<TreePtr> subtrees) {
+            return span(subtrees.begin(), subtrees.size());
+        }
+
+        /*!
+         * Create a tree node in the arena.
+         * @tparam Args ParseTree constructor arguments.
+         * @return the tree node.
+         */
+        template<class ...Args>
+        TreePtr tree(Args &&... args);
+
+        /*!
+         * @return bytes handed out by the arena.
+         */
+        [[nodiscard]] size_t allocated() const;
+
+        /*!
+         * @return bytes reserved from the system.
+         */
+        [[nodiscard]] size_t capacity() const;
+
+        /*!
+         * @return number of chunks reserved from the system.
+         */
+        [[nodiscard]] size_t chunks() const;
+
+        /*!
+         * @return the current arena position.
+         */
+        [[nodiscard]] Mark mark() const {
+            return {head, cursor, used};
+        }
+
+        /*!
+         * Release every allocation made after a mark. Released chunks are kept for reuse.
+         * @param mark position returned by mark().
+         */
+        void release(const Mark &mark);
+
+        /*!
+         * Release every allocation. The chunks are kept for reuse.
+         */
+        void reset() {
+            release({nullptr, 0, 0});
+        }
+
+        /*!
+         * Take over every chunk of another arena, so that its nodes live as long as this one.
+         * Adopted chunks are never reused and are not affected by release().
+         * @param that arena to empty.
+         */
+        void adopt(TreeArena &that);
     };
 
-    using MemoTable = std::unordered_map<MemoKey, TreePtr, MemoKeyHasher>;
+    /*!
+     * Limit that stopped a parse early.
+     */
+    enum class Exhausted : uint8_t {
+        None, Invocations, MemoEntries, Memory, Deadline
+    };
+
+    /*!
+     * The ParseBudget class. Limits of one parse, checked as rules are invoked. Limits left unset are unbounded.
+     */
+    struct ParseBudget {
+        static constexpr size_t unlimited = static_cast<size_t>(-1);
+        /*!
+         * Rule invocations, memo hits included.
+         */
+        size_t invocations = unlimited;
+        size_t memo_entries = unlimited;
+        /*!
+         * Bytes reserved by the memory table plus bytes of tree nodes.
+         */
+        size_t memory = unlimited;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        /*!
+         * Invocations between two checks of the clock and of the memory, which cost more than counting.
+         */
+        size_t interval = 1024;
+    };
+
+    /*!
+     * The ParseProgress class. How far a parse went, whether it finished or not.
+     */
+    struct ParseProgress {
+        Exhausted exhausted = Exhausted::None;
+        size_t invocations = 0;
+        /*!
+         * Start of the farthest rule invocation.
+         */
+        size_t farthest = 0;
+        /*!
+         * Id of the innermost rule invoked at the farthest position, for rule_type.
+         */
+        size_t rule = 0;
+        /*!
+         * End of the input examined, exclusive. Past farthest when the last rules looked ahead of their start.
+         */
+        size_t examined = 0;
+    };
+
+    /*!
+     * The ParseSession class. State shared by every context of one parse: the memory table, the arena owning the
+     * tree nodes, and a scratch stack where combinators collect their subtrees.
+     * Trees returned by a parse stay valid as long as the session is alive.
+     */
+    struct ParseSession {
+        /*!
+         * Memory table.
+         */
+        MemoTable table;
+        /*!
+         * Tree node storage.
+         */
+        TreeArena arena;
+        /*!
+         * Pending subtrees of the combinators being matched.
+         */
+        std::vector<TreePtr> stack;
+        /*!
+         * Streaming callback receiving the trees matched by Commit rules. Empty for ordinary parses.
+         */
+        std::function<void(TreePtr)> on_commit;
+        /*!
+         * Keep memoized entries at cuts, for sessions that are parsed again after edits.
+         */
+        bool keep_memo = false;
+        /*!
+         * Move memoized trees onto the text being parsed when they are reused, for sessions whose text is copied to
+         * a new buffer after edits.
+         */
+        bool rebase = false;
+        /*!
+         * End of the input examined by the rule being matched, exclusive.
+         */
+        size_t frontier = 0;
+        ParseBudget budget{};
+        /*!
+         * Progress as of the last check; see report().
+         */
+        ParseProgress progress{};
+        /*!
+         * Invocations granted since the last check, and those left before the next one.
+         */
+        size_t window = ParseBudget::unlimited;
+        size_t countdown = ParseBudget::unlimited;
+#ifdef GRAMMAR_PROFILE
+        /*!
+         * Per-rule statistics.
+         */
+        Profiler profiler;
+#endif
+
+        /*!
+         * Record that the input before a position has been examined.
+         * @param position end of the examined input, exclusive.
+         */
+        void examine(size_t position) {
+            frontier = std::max(frontier, position);
+        }
+
+        /*!
+         * Reuse a memoized tree.
+         * @param tree memoized tree, or nullptr for a memoized failure.
+         * @param text source input.
+         * @param position memoized position.
+         * @return the tree, moved onto the text first if the session rebases trees.
+         */
+        TreePtr reuse(TreePtr tree, std::string_view text, size_t position) {
+            return rebase && tree ? relocate(tree, text, position) : tree;
+        }
+
+        /*!
+         * Move a tree parsed from an older buffer onto the text, where it starts at a position. Nodes already in
+         * the text are kept with their subtrees.
+         * @param tree tree to move.
+         * @param text source input.
+         * @param position start of the tree in the text.
+         * @return the tree.
+         */
+        TreePtr relocate(TreePtr tree, std::string_view text, size_t position);
+
+        /*!
+         * Count a rule invocation against the budget.
+         * @param position rule start position.
+         * @param rule rule id.
+         * @return whether the parse may go on. Once a limit is hit every further invocation fails, so the parse
+         * unwinds without doing more work.
+         */
+        bool proceed(size_t position, size_t rule) {
+            if (--countdown == 0 && !check()) {
+                return false;
+            }
+            // the frontier only goes back when an invocation starts, so taking it here keeps its maximum
+            progress.examined = std::max(progress.examined, frontier);
+            if (position >= progress.farthest) {
+                progress.farthest = position;
+                progress.rule = rule;
+            }
+            return true;
+        }
+
+        /*!
+         * Check the limits once the invocations granted since the last check are used up.
+         * @return whether the parse may go on.
+         */
+        bool check();
+
+        /*!
+         * Set the budget of the next parse and restart the progress and the frontier.
+         * @param limits parse budget.
+         */
+        void limit(const ParseBudget &limits);
+
+        /*!
+         * @return the progress of the current or last parse.
+         */
+        [[nodiscard]] ParseProgress report() const {
+            auto result = progress;
+            result.invocations += window - countdown;
+            result.examined = std::max(result.examined, frontier);
+            return result;
+        }
+
+        /*!
+         * Start tracking the input examined by a memoized rule.
+         * @param position rule start position.
+         * @return frontier of the enclosing rule, to be passed to memoize().
+         */
+        size_t enter(size_t position) {
+            auto saved = frontier;
+            frontier = position;
+            return saved;
+        }
+
+        /*!
+         * Memoize the result of a rule started with enter(). Nothing is stored once the budget is exhausted: the
+         * result may come from refused invocations rather than from the input.
+         * @param key memoization key.
+         * @param tree parsed tree, or nullptr for a failure.
+         * @param saved frontier returned by enter().
+         */
+        void memoize(const MemoKey &key, TreePtr tree, size_t saved) {
+            if (progress.exhausted == Exhausted::None) {
+                table.insert(key, tree, frontier);
+            }
+            examine(saved);
+        }
+
+        /*!
+         * Move the subtrees pushed since mark into the arena.
+         * @param mark stack size before the subtrees were pushed.
+         * @return the stored span.
+         */
+        TreeSpan collect(size_t mark) {
+            auto result = arena.span(stack.data() + mark, stack.size() - mark);
+            stack.resize(mark);
+            return result;
+        }
+
+        /*!
+         * Prepare the session for a new input. Every tree of the previous parse becomes invalid; the memory of
+         * the table, the arena and the stack is kept, so a warm session parses without allocating.
+         */
+        void reset() {
+            table.reset();
+            arena.reset();
+            stack.clear();
+            limit(budget);
+        }
+    };
+
+    /*!
+     * Memoization policy of rules whose results are worth keeping, such as named rules that may be revisited
+     * after backtracking.
+     */
+    struct Memoize {
+        static constexpr bool value = true;
+    };
+
+    /*!
+     * Memoization policy of rules that are cheaper to recompute than to store, such as terminals and anonymous
+     * combinators. A transient rule must not be recursive, otherwise the linear time guarantee is lost.
+     */
+    struct Transient {
+        static constexpr bool value = false;
+    };
 
     /*!
      * The Grammar class. Represents a grammar rule.
      */
     class Grammar {
     public:
+        /*!
+         * Combinator whose semantics the rule follows. Grammars of unknown kind are their own definition.
+         */
+        using definition = Grammar;
+
+        /*!
+         * Memoization policy. Rules of unknown kind are memoized.
+         */
+        using memo_policy = Memoize;
+
         /*!
          * Parse current context.
          * @param context parser context.
          * @return tree node.
          */
         [[nodiscard]]  virtual TreePtr match(PContext context) const = 0;
+
+        /*!
+         * Memoization id of the grammar rule. Falls back to a registry lookup of the dynamic type;
+         * rules declared with the macros below override it with a cached id.
+         * @return rule id.
+         */
+        [[nodiscard]] virtual size_t id() const;
+
+        /*!
+         * Whether results of the grammar rule are kept in the memory table. Rules of unknown kind are memoized;
+         * rules declared with the macros below follow their memo_policy.
+         * @return memoization flag.
+         */
+        [[nodiscard]] virtual bool memoized() const;
     };
 
     /*!
@@ -48,9 +678,9 @@ namespace parser {
      */
     struct PContext {
         /*!
-         * Memory table.
+         * Parse session.
          */
-        std::shared_ptr<MemoTable> table;
+        std::shared_ptr<ParseSession> session;
         /*!
          * Source input.
          */
@@ -66,10 +696,10 @@ namespace parser {
 
         /*!
          * Create a memoization key for a grammar rule from current context.
-         * @param index grammar rule type info.
+         * @param rule grammar rule id.
          * @return memoization
          */
-        [[nodiscard]] MemoKey key(const std::type_info &index) const;
+        [[nodiscard]] MemoKey key(size_t rule) const;
 
         /*!
          * Create a new parser context with current location as the new starting point.
@@ -87,30 +717,39 @@ namespace parser {
          */
         std::string_view parsed_region;
         /*!
-         * Type info of the grammar rule.
+         * Subtrees, stored in the arena; see subtrees(). The count and the rule id share one word, which keeps a
+         * node at 32 bytes.
          */
-        std::type_index instance;
+        TreePtr *children;
+        uint32_t child_count;
         /*!
-         * Subtrees.
+         * Id of the grammar rule, see rule_id.
          */
-        std::vector<TreePtr> subtrees;
+        uint32_t rule;
 
         /*!
          * Create a new tree node based parsed region.
          * @param parsed_region source section of current tree node.
-         * @param instance grammar instance type info.
+         * @param rule grammar rule id.
          * @param subtrees subtree nodes.
          */
-        ParseTree(std::string_view parsed_region, std::type_index instance, std::vector<TreePtr> subtrees);
+        ParseTree(std::string_view parsed_region, size_t rule, TreeSpan subtrees);
 
         /*!
          * Create a new tree node based on current context.
          * @param context parser context.
          * @param length parsed length.
-         * @param index grammar instance type info.
+         * @param rule grammar rule id.
          * @param subtrees subtree nodes.
          */
-        ParseTree(const PContext &context, size_t length, std::type_index index, std::vector<TreePtr> subtrees);
+        ParseTree(const PContext &context, size_t length, size_t rule, TreeSpan subtrees);
+
+        /*!
+         * @return subtree nodes.
+         */
+        [[nodiscard]] TreeSpan subtrees() const {
+            return {children, child_count};
+        }
 
         /*!
          * Print out the parsed tree structure.
@@ -122,37 +761,65 @@ namespace parser {
         /*!
          * Collapse silent rules.
          * @tparam S rule selector mark those active rules.
+         * @param arena arena to allocate the collapsed nodes from.
          * @return A new ParseTree with silent rule nodes collapsed.
          */
         template<class S>
-        std::vector<TreePtr> compress() const;
+        std::vector<TreePtr> compress(TreeArena &arena) const;
     };
 
 
+#ifdef GRAMMAR_PROFILE
+#define PROFILED(...) __VA_ARGS__
+#else
+#define PROFILED(...)
+#endif
+
 #define GRAMMAR_MATCH(TYPE, BLOCK) \
     parser::TreePtr parser::TYPE::match(parser::PContext context) const { \
-        auto iter = context.table->find(context.key(typeid(*this)));                            \
-        if (iter != context.table->end()) {                   \
-            return iter->second;                        \
+        const bool memo_enabled = memoized();                            \
+        if (!context.session->proceed(context.start_position, id())) { \
+            return nullptr;                                            \
+        }                                                              \
+        PROFILED(parser::ProfileScope profile_scope{context.session->profiler, context.session->frontier, \
+                                                    id(), context.start_position};) \
+        auto memo = memo_enabled ? context.session->table.find(context.key(id())) : nullptr; \
+        if (memo) {                   \
+            PROFILED(profile_scope.hit();) \
+            context.session->examine(context.session->table.reach(context.start_position)); \
+            return context.session->reuse(memo->tree, context.text, context.start_position); \
         } else {                    \
+            PROFILED(if (memo_enabled) profile_scope.miss();) \
+            const size_t memo_frontier = memo_enabled ? context.session->enter(context.start_position) : 0; \
             BLOCK                            \
         } \
     }
 
+#define GRAMMAR_ID \
+    size_t id() const override { return parser::rule_id<std::decay_t<decltype(*this)>>(); } \
+    bool memoized() const override { return std::decay_t<decltype(*this)>::memo_policy::value; }
 
 #define GRAMMAR_DECLARE(TYPE, BASE, ...) \
 /*! PEG Grammar rule TYPE. */                                         \
 struct TYPE : public BASE  { \
+    using definition = TYPE;                        \
+    using memo_policy = Transient;                  \
     TreePtr match(PContext context) const override; \
+    GRAMMAR_ID                                      \
     __VA_ARGS__                                     \
 };
 
 #define MEMOIZATION(tree) \
-    context.table->insert( { context.key(typeid(*this)), tree } ); \
+    PROFILED({ parser::TreePtr profiled = (tree); \
+               profile_scope.result(profiled != nullptr, profiled ? profiled->parsed_region.size() : 0); }) \
+    if (memo_enabled) context.session->memoize(context.key(id()), tree, memo_frontier); \
 
 
 #define MAKE_TREE(length, ...) \
-    std::make_shared<ParseTree>(context, length, typeid(*this), std::vector<TreePtr> { __VA_ARGS__ })
+    context.session->arena.tree(context, length, id(), context.session->arena.span({ __VA_ARGS__ }))
+
+#define MAKE_TREE_FROM(length, mark) \
+    context.session->arena.tree(context, length, id(), context.session->collect(mark))
 
 
     GRAMMAR_DECLARE(Start, Grammar);
@@ -176,14 +843,25 @@ struct TYPE : public BASE  { \
     GRAMMAR_DECLARE(Seq<Head>, Grammar, virtual bool seq_match(PContext &context, std::vector<TreePtr> &) const;);
 
     template<typename Head, typename ...Tail>
-    GRAMMAR_DECLARE(Ord, Ord < Tail...>);
+    GRAMMAR_DECLARE(Ord, Ord < Tail...>,
+                    virtual TreePtr ord_match(PContext &context) const override;);
 
     template<typename Head>
-    GRAMMAR_DECLARE(Ord<Head>, Grammar);
+    GRAMMAR_DECLARE(Ord<Head>, Grammar, virtual TreePtr ord_match(PContext &context) const;);
 
     template<typename S>
     GRAMMAR_DECLARE(Optional, Grammar);
 
+    /*!
+     * Match a rule repeatedly from the current position, advancing the context accumulator.
+     * Subtrees are pushed on the session stack, except for cuts in streaming sessions, whose nodes are released.
+     * @tparam S repeated rule.
+     * @param context parser context.
+     * @return number of repetitions.
+     */
+    template<typename S>
+    size_t repeat(PContext &context);
+
     template<typename S>
     GRAMMAR_DECLARE(Plus, Grammar);
 
@@ -197,32 +875,103 @@ struct TYPE : public BASE  { \
     template<typename S>
     GRAMMAR_DECLARE(Not, Grammar);
 
-#define RULE(NAME, ...)      \
+    /*!
+     * Builtin combinator to declare a cut: once S has matched, the parser never revisits earlier positions.
+     * The memory table is retired at the cut. In streaming sessions the matched tree is handed to the commit
+     * callback and its nodes are released, leaving a leaf node in the tree.
+     * A commit is final: it is not undone if an enclosing rule fails afterwards.
+     * @tparam S committed rule.
+     */
+    template<typename S>
+    struct Commit : S {
+        using definition = Commit;
+
+        TreePtr match(PContext context) const override;
+
+        GRAMMAR_ID
+    };
+
+    /*!
+     * Match a named rule. Rules whose definition is a deterministic regular expression are matched by their
+     * Lexer as one leaf node; the others run their definition.
+     * @tparam T grammar rule.
+     * @tparam Base base class of the rule.
+     * @param rule rule instance.
+     * @param context parsing context.
+     * @return the parse tree, or nullptr if the rule does not match.
+     */
+    template<class T, class Base>
+    TreePtr match_rule(const T &rule, PContext context);
+
+    /*!
+     * Parse a text within a budget. When a limit is hit the parse stops early and fails; the memory table is
+     * dropped and the tree memory is released for reuse, so an aborted request holds nothing but the session.
+     * @tparam Rule root grammar rule.
+     * @param session parse session, which keeps the budget for its next parses.
+     * @param text source input.
+     * @param budget limits of the parse.
+     * @param progress receives how far the parse went and which limit stopped it, if any.
+     * @return the tree, or nullptr if the text does not match or the parse was stopped.
+     */
+    template<class Rule>
+    TreePtr parse_budgeted(const std::shared_ptr<ParseSession> &session, std::string_view text,
+                           const ParseBudget &budget, ParseProgress &progress);
+
+#define RULE_MATCH(NAME, ...) \
+    using rule_type = NAME; \
+    parser::TreePtr match(parser::PContext context) const override { \
+        return parser::match_rule<NAME, __VA_ARGS__>(*this, context); \
+    }
+
+#define POLICY_RULE(NAME, POLICY, ...)      \
 struct NAME : public __VA_ARGS__ {   \
+    using memo_policy = POLICY; \
+    GRAMMAR_ID \
+    RULE_MATCH(NAME, __VA_ARGS__) \
 };
 
+#define RULE(NAME, ...) POLICY_RULE(NAME, parser::Memoize, __VA_ARGS__)
+
     /*!
      * Grammar selector.
      * @tparam Head active grammars.
      * @tparam Tail active grammar.
      */
     template<typename Head, typename... Tail>
-    struct Selector : Selector<Tail...> {
-        bool operator()(std::type_index index) override {
-            if (index == typeid(Head)) {
-                return true;
-            }
-            return Selector<Tail...>::operator()(index);
+    struct Selector {
+        /*!
+         * Compile-time membership test.
+         * @tparam T grammar rule.
+         * @return whether the rule is active.
+         */
+        template<class T>
+        static constexpr bool selects() {
+            return std::is_same_v<T, Head> || (std::is_same_v<T, Tail> || ...);
         }
-    };
 
-    template<typename Last>
-    struct Selector<Last> {
-        virtual bool operator()(std::type_index index) {
-            if (index == typeid(Last)) {
-                return true;
-            }
-            return false;
+        /*!
+         * @return the active rules, as a bitset indexed by rule id.
+         */
+        static const std::vector<bool> &members() {
+            static const std::vector<bool> set = [] {
+                std::vector<bool> result;
+                for (auto id : {rule_id<Head>(), rule_id<Tail>()...}) {
+                    result.resize(std::max(result.size(), id + 1));
+                    result[id] = true;
+                }
+                return result;
+            }();
+            return set;
+        }
+
+        /*!
+         * Runtime membership test.
+         * @param rule grammar rule id.
+         * @return whether the rule is active.
+         */
+        bool operator()(size_t rule) const {
+            auto &set = members();
+            return rule < set.size() && set[rule];
         }
     };
 
@@ -242,14 +991,18 @@ struct NAME : public __VA_ARGS__ {   \
     template<typename Sep, typename Rule0, typename... RulesRest>
     struct Interleaved<Sep, Rule0, RulesRest...>
             : Seq<Rule0, Sep, Interleaved<Sep, RulesRest...>> {
+        GRAMMAR_ID
     };
 
     template<typename Rule0>
     struct Interleaved<Rule0> : Rule0 {
+        using memo_policy = Transient;
+        GRAMMAR_ID
     };
 
     template<typename... Rules>
     struct SpaceInterleaved : public Interleaved<Separator, Rules...> {
+        GRAMMAR_ID
     };
     /*!
     * Builtin combinator to declare a keyword.
@@ -257,6 +1010,242 @@ struct NAME : public __VA_ARGS__ {   \
     */
     template<char ...Chars>
     struct Keyword : Seq<Char<Chars>...> {
+        GRAMMAR_ID
+        RULE_MATCH(Keyword, Seq<Char<Chars>...>)
+    };
+
+    /*!
+     * The CharSet class. A set of bytes, usable at compile time.
+     */
+    struct CharSet {
+        uint64_t bits[4]{};
+
+        /*!
+         * Create the set of an inclusive byte range.
+         * @param begin first byte.
+         * @param end last byte.
+         * @return the byte set.
+         */
+        static constexpr CharSet range(unsigned char begin, unsigned char end) {
+            CharSet set{};
+            for (unsigned i = begin; i <= end; ++i) {
+                set.bits[i >> 6u] |= uint64_t{1} << (i & 63u);
+            }
+            return set;
+        }
+
+        static constexpr CharSet full() {
+            return range(0, 255);
+        }
+
+        [[nodiscard]] constexpr bool contains(unsigned char c) const {
+            return bits[c >> 6u] >> (c & 63u) & 1u;
+        }
+
+        [[nodiscard]] constexpr bool empty() const {
+            return !(bits[0] | bits[1] | bits[2] | bits[3]);
+        }
+
+        constexpr CharSet operator|(const CharSet &that) const {
+            return {{bits[0] | that.bits[0], bits[1] | that.bits[1], bits[2] | that.bits[2], bits[3] | that.bits[3]}};
+        }
+    };
+
+    /*!
+     * Compile-time lookahead analysis of a combinator.
+     * `first()` over-approximates the bytes a successful match can start with, and `nullable()` tells whether the
+     * combinator may succeed without consuming input. Specialized for every builtin combinator; other rules are
+     * analyzed through their definition.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct Lookahead;
+
+    template<class T>
+    constexpr CharSet first_set() {
+        return Lookahead<typename T::definition>::first();
+    }
+
+    template<class T>
+    constexpr bool nullable() {
+        return Lookahead<typename T::definition>::nullable();
+    }
+
+    /*!
+     * Check whether a rule may match at a position, without running it or tracking the examined input.
+     * @tparam T grammar rule.
+     * @param text source input.
+     * @param position start position.
+     * @return false if the rule surely fails at the position.
+     */
+    template<class T>
+    bool may_start(std::string_view text, size_t position) {
+        if constexpr (nullable<T>()) {
+            return true;
+        } else {
+            return position < text.size() && first_set<T>().contains(static_cast<unsigned char>(text[position]));
+        }
+    }
+
+    /*!
+     * Check whether a rule may match at the current parse position, without running it.
+     * @tparam T grammar rule.
+     * @param context parser context.
+     * @return false if the rule surely fails at the current position.
+     */
+    template<class T>
+    bool may_match(const PContext &context) {
+        if constexpr (nullable<T>()) {
+            return true;
+        } else {
+            auto position = context.start_position + context.accumulator;
+            context.session->examine(position + 1);
+            return position < context.text.size() &&
+                   first_set<T>().contains(static_cast<unsigned char>(context.text[position]));
+        }
+    }
+
+    template<>
+    struct Lookahead<Grammar> {
+        static constexpr CharSet first() { return CharSet::full(); }
+
+        static constexpr bool nullable() { return true; }
+    };
+
+    template<>
+    struct Lookahead<Start> {
+        static constexpr CharSet first() { return {}; }
+
+        static constexpr bool nullable() { return true; }
+    };
+
+    template<>
+    struct Lookahead<End> : Lookahead<Start> {
+    };
+
+    template<>
+    struct Lookahead<Nothing> : Lookahead<Start> {
+    };
+
+    template<>
+    struct Lookahead<Any> : Lookahead<Grammar> {
+    };
+
+    template<char C>
+    struct Lookahead<Char<C>> {
+        static constexpr CharSet first() { return CharSet::range(C, C); }
+
+        static constexpr bool nullable() { return false; }
+    };
+
+    template<char Begin, char End>
+    struct Lookahead<CharRange<Begin, End>> {
+        static constexpr CharSet first() { return Begin <= End ? CharSet::range(Begin, End) : CharSet{}; }
+
+        static constexpr bool nullable() { return false; }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Lookahead<Seq<Head, Tail...>> {
+        static constexpr CharSet first() {
+            if constexpr (parser::nullable<Head>()) {
+                return first_set<Head>() | Lookahead<Seq<Tail...>>::first();
+            } else {
+                return first_set<Head>();
+            }
+        }
+
+        static constexpr bool nullable() {
+            if constexpr (parser::nullable<Head>()) {
+                return Lookahead<Seq<Tail...>>::nullable();
+            } else {
+                return false;
+            }
+        }
+    };
+
+    template<typename Head>
+    struct Lookahead<Seq<Head>> {
+        static constexpr CharSet first() { return first_set<Head>(); }
+
+        static constexpr bool nullable() { return parser::nullable<Head>(); }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Lookahead<Ord<Head, Tail...>> {
+        static constexpr CharSet first() { return (first_set<Head>() | ... | first_set<Tail>()); }
+
+        static constexpr bool nullable() { return (parser::nullable<Head>() || ... || parser::nullable<Tail>()); }
+    };
+
+    template<typename S>
+    struct Lookahead<Optional<S>> {
+        static constexpr CharSet first() { return first_set<S>(); }
+
+        static constexpr bool nullable() { return true; }
+    };
+
+    template<typename S>
+    struct Lookahead<Plus<S>> {
+        static constexpr CharSet first() { return first_set<S>(); }
+
+        static constexpr bool nullable() { return parser::nullable<S>(); }
+    };
+
+    template<typename S>
+    struct Lookahead<Asterisk<S>> : Lookahead<Optional<S>> {
+    };
+
+    template<typename S>
+    struct Lookahead<Not<S>> : Lookahead<Start> {
+    };
+
+    template<typename S>
+    struct Lookahead<Commit<S>> : Lookahead<typename S::definition> {
+    };
+
+    /*!
+     * Compile-time check of whether a combinator is a cut declared with Commit.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct IsCommit : std::false_type {
+    };
+
+    template<typename S>
+    struct IsCommit<Commit<S>> : std::true_type {
+    };
+
+    template<class T>
+    constexpr bool commits() {
+        return IsCommit<typename T::definition>::value;
+    }
+
+    /*!
+     * Compile-time check of whether a combinator always consumes exactly one byte from a fixed byte set, which is
+     * then its FIRST set. Holds for Char, CharRange and Ord of such classes.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct ByteClass : std::false_type {
+    };
+
+    template<class T>
+    constexpr bool byte_class() {
+        return ByteClass<typename T::definition>::value;
+    }
+
+    template<char C>
+    struct ByteClass<Char<C>> : std::true_type {
+    };
+
+    template<char Begin, char End>
+    struct ByteClass<CharRange<Begin, End>> : std::true_type {
+    };
+
+    template<typename Head, typename ...Tail>
+    struct ByteClass<Ord<Head, Tail...>>
+            : std::integral_constant<bool, (byte_class<Head>() && ... && byte_class<Tail>())> {
     };
 
     /*!
@@ -2,9 +2,17 @@
 #define FRONTEND_GRAMMAR_IPP
 
 #include "grammar.h"
+#include "scan.h"
+#include "lexer.h"
+
+template<class ...Args>
+parser::TreePtr parser::TreeArena::tree(Args &&... args) {
+    return new(allocate(sizeof(ParseTree), alignof(ParseTree))) ParseTree(std::forward<Args>(args)...);
+}
 
 template<char C>
 GRAMMAR_MATCH(Char<C>, {
+    context.session->examine(context.start_position + 1);
     auto result = context.start_position != context.text.size() &&
                   context.text[context.start_position] == C
                   ? MAKE_TREE(1)
@@ -15,6 +23,7 @@ GRAMMAR_MATCH(Char<C>, {
 
 template<char Begin, char End>
 GRAMMAR_MATCH(TEMPLATE(CharRange, Begin, End), {
+    context.session->examine(context.start_position + 1);
     auto result =
             ( context.start_position < context.text.size() &&
             context.text[context.start_position] >= Begin &&
@@ -27,14 +36,15 @@ GRAMMAR_MATCH(TEMPLATE(CharRange, Begin, End), {
 
 template<typename Head, typename... Tail>
 GRAMMAR_MATCH(TEMPLATE(Seq, Head, Tail...), {
-    std::vector<TreePtr> subtrees;
-    auto flag = seq_match(context, subtrees);
+    auto mark = context.session->stack.size();
+    auto flag = seq_match(context, context.session->stack);
     if (flag) {
         auto tree =
-                MAKE_TREE(context.accumulator, std::move(subtrees));
+                MAKE_TREE_FROM(context.accumulator, mark);
         MEMOIZATION(tree);
         return tree;
     }
+    context.session->stack.resize(mark);
     MEMOIZATION(nullptr);
     return nullptr;
 })
@@ -79,19 +89,28 @@ bool parser::Seq<Last>::seq_match(PContext &context,
 
 template<typename Head, typename... Tail>
 GRAMMAR_MATCH(TEMPLATE(Ord, Head, Tail...), {
-    auto tree = Head().match(context.next());
+    auto tree = ord_match(context);
     if (tree) {
         auto ord = MAKE_TREE(tree->parsed_region.size(), tree);
         MEMOIZATION(ord);
         return ord;
-    } else {
-        return Ord<Tail...>::match(context);
     }
+    MEMOIZATION(nullptr);
+    return nullptr;
 })
 
+template<typename Head, typename... Tail>
+parser::TreePtr parser::Ord<Head, Tail...>::ord_match(PContext &context) const {
+    auto tree = may_match<Head>(context) ? Head().match(context.next()) : nullptr;
+    if (tree) {
+        return tree;
+    }
+    return this->Ord<Tail...>::ord_match(context);
+}
+
 template<typename Head>
 GRAMMAR_MATCH(TEMPLATE(Ord, Head), {
-    TreePtr tree = Head().match(context.next());
+    auto tree = ord_match(context);
     if (tree) {
         auto ord = MAKE_TREE(tree->parsed_region.size(), tree);
         MEMOIZATION(ord);
@@ -101,9 +120,14 @@ GRAMMAR_MATCH(TEMPLATE(Ord, Head), {
     return nullptr;
 })
 
+template<typename Head>
+parser::TreePtr parser::Ord<Head>::ord_match(PContext &context) const {
+    return may_match<Head>(context) ? Head().match(context.next()) : nullptr;
+}
+
 template<typename S>
 GRAMMAR_MATCH(Optional<S>, {
-    TreePtr tree = S().match(context.next());
+    TreePtr tree = may_match<S>(context) ? S().match(context.next()) : nullptr;
     if (tree) {
         auto some = MAKE_TREE(tree->parsed_region.size(), tree);
         MEMOIZATION(some);
@@ -127,18 +151,43 @@ GRAMMAR_MATCH(Not<S>, {
 })
 
 template<typename S>
-GRAMMAR_MATCH(Plus<S>, {
-    std::vector<TreePtr> subtrees{};
+size_t parser::repeat(PContext &context) {
+    size_t count = 0;
     TreePtr tree = nullptr;
-    while ((tree = S().match(context.next()))) {
-        subtrees.push_back(tree);
+    if constexpr (commits<S>()) {
+        if (context.session->on_commit) {
+            auto mark = context.session->arena.mark();
+            while (may_match<S>(context) && (tree = S().match(context.next()))) {
+                context.accumulator += tree->parsed_region.size();
+                context.session->arena.release(mark);
+                count++;
+            }
+            return count;
+        }
+    }
+    while (may_match<S>(context) && (tree = S().match(context.next()))) {
+        context.session->stack.push_back(tree);
         context.accumulator += tree->parsed_region.size();
+        count++;
+    }
+    return count;
+}
+
+template<typename S>
+GRAMMAR_MATCH(Plus<S>, {
+    if constexpr (byte_class<S>()) {
+        auto length = scan<S>(context.text, context.start_position);
+        context.session->examine(context.start_position + length + 1);
+        auto run = length ? MAKE_TREE(length) : nullptr;
+        MEMOIZATION(run);
+        return run;
     }
-    if (subtrees.empty()) {
+    auto mark = context.session->stack.size();
+    if (!repeat<S>(context)) {
         MEMOIZATION(nullptr);
         return nullptr;
     } else {
-        auto result = MAKE_TREE(context.accumulator, std::move(subtrees));
+        auto result = MAKE_TREE_FROM(context.accumulator, mark);
         MEMOIZATION(result);
         return result;
     }
@@ -146,38 +195,106 @@ GRAMMAR_MATCH(Plus<S>, {
 
 template<typename S>
 GRAMMAR_MATCH(Asterisk<S>, {
-    std::vector<TreePtr> subtrees{};
-    TreePtr tree = nullptr;
-    while ((tree = S().match(context.next()))) {
-        subtrees.push_back(tree);
-        context.accumulator += tree->parsed_region.size();
+    if constexpr (byte_class<S>()) {
+        auto length = scan<S>(context.text, context.start_position);
+        context.session->examine(context.start_position + length + 1);
+        auto run = MAKE_TREE(length);
+        MEMOIZATION(run);
+        return run;
     }
-    if (subtrees.empty()) {
+    auto mark = context.session->stack.size();
+    if (!repeat<S>(context)) {
         auto result = MAKE_TREE(0);
         MEMOIZATION(result);
         return result;
     } else {
-        auto result = MAKE_TREE(context.accumulator, std::move(subtrees));
+        auto result = MAKE_TREE_FROM(context.accumulator, mark);
         MEMOIZATION(result);
         return result;
     }
 })
 
+template<typename S>
+parser::TreePtr parser::Commit<S>::match(PContext context) const {
+    auto &session = *context.session;
+    auto mark = session.arena.mark();
+    auto tree = S::match(context);
+    if (!tree) {
+        return nullptr;
+    }
+    auto length = tree->parsed_region.size();
+    if (!session.keep_memo) {
+        session.table.retire(context.start_position + length);
+    }
+    if (session.on_commit) {
+        session.on_commit(tree);
+        session.arena.release(mark);
+        return session.arena.tree(context, length, id(), TreeSpan{});
+    }
+    return tree;
+}
+
+template<class T, class Base>
+parser::TreePtr parser::match_rule(const T &rule, PContext context) {
+    if constexpr (!lexical<T>()) {
+        return rule.Base::match(context);
+    } else {
+        const bool memo_enabled = rule.memoized();
+        if (!context.session->proceed(context.start_position, rule.id())) {
+            return nullptr;
+        }
+        PROFILED(parser::ProfileScope profile_scope{context.session->profiler, context.session->frontier,
+                                                    rule.id(), context.start_position};)
+        auto memo = memo_enabled ? context.session->table.find(context.key(rule.id())) : nullptr;
+        if (memo) {
+            PROFILED(profile_scope.hit();)
+            context.session->examine(context.session->table.reach(context.start_position));
+            return context.session->reuse(memo->tree, context.text, context.start_position);
+        }
+        PROFILED(if (memo_enabled) profile_scope.miss();)
+        const size_t memo_frontier = memo_enabled ? context.session->enter(context.start_position) : 0;
+        size_t examined;
+        auto length = lex<T>(context.text, context.start_position, examined);
+        context.session->examine(examined);
+        auto result = length == no_match ? nullptr
+                                         : context.session->arena.tree(context, length, rule.id(), TreeSpan{});
+        PROFILED(profile_scope.result(result != nullptr, length == no_match ? 0 : length);)
+        if (memo_enabled) {
+            context.session->memoize(context.key(rule.id()), result, memo_frontier);
+        }
+        return result;
+    }
+}
+
+template<class Rule>
+parser::TreePtr parser::parse_budgeted(const std::shared_ptr<ParseSession> &session, std::string_view text,
+                                       const ParseBudget &budget, ParseProgress &progress) {
+    session->limit(budget);
+    auto tree = Rule().match(PContext{session, text, 0, 0});
+    progress = session->report();
+    if (progress.exhausted != Exhausted::None) {
+        session->table.clear();
+        session->arena.reset();
+        session->stack.clear();
+        return nullptr;
+    }
+    return tree;
+}
 
 template <class S>
-std::vector<parser::TreePtr> parser::ParseTree::compress() const {
+std::vector<parser::TreePtr> parser::ParseTree::compress(TreeArena &arena) const {
     std::vector<TreePtr> collect;
-    for (auto &i : subtrees) {
-        auto tmp = i->template compress<S>();
-        for (auto &j : tmp) {
-            collect.push_back(std::move(j));
+    for (auto i : subtrees()) {
+        auto tmp = i->template compress<S>(arena);
+        for (auto j : tmp) {
+            collect.push_back(j);
         }
     }
-    if (S { } (instance )) {
-        return  { std::make_shared<ParseTree>(
+    if (S { } (rule )) {
+        return  { arena.tree(
             this->parsed_region,
-            this->instance,
-            collect
+            this->rule,
+            arena.span(collect.data(), collect.size())
         ) };
     } else {
         return collect;
@@ -0,0 +1,165 @@
+//
+// Created by schrodinger on 2/7/21.
+//
+
+#ifndef FRONTEND_INCREMENTAL_H
+#define FRONTEND_INCREMENTAL_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+#include <deque>
+
+namespace parser {
+
+    /*!
+     * The IncrementalParser class. A persistent parse session over an editable text.
+     * Edits keep every memoized entry that did not examine the edited range, so parsing again only re-runs the
+     * rules around the damage and reuses the untouched subtrees.
+     * Edits are recorded in a piece table over the last parsed text and the inserted bytes; parsing copies the text
+     * into a new buffer and moves the reused subtrees onto it, so that every tree points into the current text.
+     * Older buffers are retained until the session is compacted, for the trees of earlier parses.
+     * @tparam Rule root grammar rule.
+     */
+    template<class Rule>
+    class IncrementalParser {
+        /*!
+         * A run of the text, from the last parsed buffer or from the inserted bytes.
+         */
+        struct Piece {
+            bool inserted;
+            size_t start;
+            size_t length;
+        };
+
+        std::shared_ptr<ParseSession> session = std::make_shared<ParseSession>();
+        std::deque<std::string> versions{};
+        std::string insertions{};
+        std::vector<Piece> pieces{};
+        size_t length;
+        bool edited = false;
+        size_t compact_limit;
+
+        /*!
+         * Copy the pieces into a new buffer.
+         */
+        void settle() {
+            if (!edited) {
+                return;
+            }
+            std::string next;
+            next.reserve(length);
+            for (auto &piece : pieces) {
+                next.append(piece.inserted ? insertions : versions.back(), piece.start, piece.length);
+            }
+            versions.push_back(std::move(next));
+            insertions.clear();
+            pieces.clear();
+            if (length) {
+                pieces.push_back({false, 0, length});
+            }
+            edited = false;
+            if (versions.size() > compact_limit) {
+                compact();
+            }
+        }
+
+    public:
+        /*!
+         * Create a parser over an initial text.
+         * @param text initial source input.
+         * @param compact_limit number of retained text buffers that triggers a full reparse.
+         */
+        explicit IncrementalParser(std::string text, size_t compact_limit = 64)
+                : length(text.size()), compact_limit(compact_limit) {
+            session->keep_memo = true;
+            session->rebase = true;
+            if (length) {
+                pieces.push_back({false, 0, length});
+            }
+            versions.push_back(std::move(text));
+        }
+
+        /*!
+         * @return current source input, valid until the next edit.
+         */
+        [[nodiscard]] std::string_view text() {
+            settle();
+            return versions.back();
+        }
+
+        /*!
+         * Parse the current text, reusing the entries that survived previous edits.
+         * @return the tree, owned by the parser and valid until the next compaction.
+         */
+        TreePtr parse() {
+            auto current = text();
+            session->frontier = 0;
+            return Rule().match(PContext{session, current, 0, 0});
+        }
+
+        /*!
+         * Replace a range of the text. Takes time in the number of edits since the last parse and in the damage
+         * to the memoized entries, not in the length of the text.
+         * @param offset edit position.
+         * @param removed number of removed bytes.
+         * @param inserted inserted text.
+         */
+        void apply_edit(size_t offset, size_t removed, std::string_view inserted) {
+            offset = std::min(offset, length);
+            removed = std::min(removed, length - offset);
+            if (!removed && inserted.empty()) {
+                return;
+            }
+            session->table.edit(offset, removed, inserted.size(), length);
+            std::vector<Piece> next;
+            next.reserve(pieces.size() + 2);
+            bool placed = false;
+            auto place = [&]() {
+                if (!placed && !inserted.empty()) {
+                    next.push_back({true, insertions.size(), inserted.size()});
+                }
+                placed = true;
+            };
+            size_t position = 0;
+            for (auto &piece : pieces) {
+                auto end = position + piece.length;
+                if (position < offset) {
+                    next.push_back({piece.inserted, piece.start, std::min(end, offset) - position});
+                }
+                if (end > offset + removed) {
+                    place();
+                    auto from = std::max(position, offset + removed);
+                    next.push_back({piece.inserted, piece.start + (from - position), end - from});
+                }
+                position = end;
+            }
+            place();
+            insertions.append(inserted);
+            pieces.swap(next);
+            length = length - removed + inserted.size();
+            edited = true;
+        }
+
+        /*!
+         * Drop every memoized entry, tree node and old text version.
+         */
+        void compact() {
+            settle();
+            auto current = std::move(versions.back());
+            versions.clear();
+            versions.push_back(std::move(current));
+            session = std::make_shared<ParseSession>();
+            session->keep_memo = true;
+            session->rebase = true;
+        }
+
+        /*!
+         * @return the parse session, for inspection.
+         */
+        [[nodiscard]] const ParseSession &state() const {
+            return *session;
+        }
+    };
+}
+
+#endif //FRONTEND_INCREMENTAL_H
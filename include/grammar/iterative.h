@@ -0,0 +1,325 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#ifndef FRONTEND_ITERATIVE_H
+#define FRONTEND_ITERATIVE_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+#include <map>
+
+namespace parser {
+
+    /*!
+     * Operations of the iterative engine, one per kind of combinator.
+     */
+    enum class Operation : uint8_t {
+        Char, Range, Any, Start, End, Nothing,
+        /*!
+         * Plus or Asterisk of a byte class, matched by scan(), or by a scalar loop over the first set when there
+         * is no scanner.
+         */
+        ScanPlus, ScanAsterisk,
+        /*!
+         * Named regular rule, matched by lex().
+         */
+        Lex,
+        /*!
+         * Rule of unknown kind, matched through its own match.
+         */
+        Foreign,
+        /*!
+         * Byte string of a loaded grammar, in RuleGraph::literals.
+         */
+        Literal,
+        /*!
+         * One byte of the first set.
+         */
+        Class,
+        Seq, Ord, Optional, Not, Plus, Asterisk, Commit
+    };
+
+    /*!
+     * The GraphNode class. A grammar rule as seen by the iterative engine: the operation of the combinator that
+     * defines it, and the identity of the rule, which names its tree nodes and memory table entries.
+     */
+    struct GraphNode {
+        Operation op = Operation::Nothing;
+        bool memoized = false;
+        /*!
+         * Lookahead of the rule, checked before it is tried as an alternative or repeated.
+         */
+        bool nullable = true;
+        CharSet first{};
+        /*!
+         * Bytes of Char and CharRange.
+         */
+        char low = 0;
+        char high = 0;
+        /*!
+         * Children, as a range of GraphNode indices in RuleGraph::edges. A Literal uses them as a range of bytes
+         * in RuleGraph::literals.
+         */
+        uint32_t edges = 0;
+        uint32_t children = 0;
+        /*!
+         * Rule id naming the tree nodes and memory table entries.
+         */
+        size_t id = 0;
+        size_t (*scan)(std::string_view, size_t) = nullptr;
+        size_t (*lex)(std::string_view, size_t, size_t &) = nullptr;
+        TreePtr (*foreign)(const PContext &) = nullptr;
+    };
+
+    /*!
+     * The RuleGraph class. Grammar of a root rule lowered to a graph, where recursive rules are cycles.
+     */
+    struct RuleGraph {
+        std::vector<GraphNode> nodes{};
+        std::vector<uint32_t> edges{};
+        std::string literals{};
+        uint32_t root = 0;
+    };
+
+    /*!
+     * The GraphBuilder class. Lowers grammar types to a RuleGraph, one node per pair of defining combinator and
+     * rule identity. The combinator usually is the rule itself; Commit<S> runs S under its own identity.
+     */
+    class GraphBuilder {
+        RuleGraph graph{};
+        std::map<std::pair<std::type_index, std::type_index>, uint32_t> indices{};
+
+        template<class D>
+        friend struct Lower;
+
+    public:
+        /*!
+         * Lower a rule with the identity of another one.
+         * @tparam B rule whose definition is run.
+         * @tparam I rule naming the results.
+         * @return index of the node.
+         */
+        template<class B, class I = B>
+        uint32_t node();
+
+        RuleGraph build(uint32_t root) {
+            graph.root = root;
+            return std::move(graph);
+        }
+    };
+
+    /*!
+     * Lowering of a combinator. Specialized for every builtin combinator; the primary template handles rules of
+     * unknown kind.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct Lower {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Foreign;
+            // the rule memoizes itself
+            node.memoized = false;
+            node.foreign = [](const PContext &context) {
+                return I().B::match(context);
+            };
+        }
+    };
+
+    template<char C>
+    struct Lower<Char<C>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Char;
+            node.low = node.high = C;
+        }
+    };
+
+    template<char Begin, char End>
+    struct Lower<CharRange<Begin, End>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Range;
+            node.low = Begin;
+            node.high = End;
+        }
+    };
+
+    template<>
+    struct Lower<Any> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Any;
+        }
+    };
+
+    template<>
+    struct Lower<Start> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Start;
+        }
+    };
+
+    template<>
+    struct Lower<End> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::End;
+        }
+    };
+
+    template<>
+    struct Lower<Nothing> {
+        template<class B, class I>
+        static void fill(GraphBuilder &, GraphNode &node, std::vector<uint32_t> &) {
+            node.op = Operation::Nothing;
+        }
+    };
+
+    template<typename ...Rules>
+    struct Lower<Seq<Rules...>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            node.op = Operation::Seq;
+            (children.push_back(builder.node<Rules>()), ...);
+        }
+    };
+
+    template<typename ...Rules>
+    struct Lower<Ord<Rules...>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            node.op = Operation::Ord;
+            (children.push_back(builder.node<Rules>()), ...);
+        }
+    };
+
+    template<typename S>
+    struct Lower<Optional<S>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            node.op = Operation::Optional;
+            children.push_back(builder.node<S>());
+        }
+    };
+
+    template<typename S>
+    struct Lower<Not<S>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            node.op = Operation::Not;
+            children.push_back(builder.node<S>());
+        }
+    };
+
+    template<typename S>
+    struct Lower<Plus<S>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            if constexpr (byte_class<S>()) {
+                node.op = Operation::ScanPlus;
+                node.scan = &parser::scan<S>;
+            } else {
+                node.op = Operation::Plus;
+                children.push_back(builder.node<S>());
+            }
+        }
+    };
+
+    template<typename S>
+    struct Lower<Asterisk<S>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            if constexpr (byte_class<S>()) {
+                node.op = Operation::ScanAsterisk;
+                node.scan = &parser::scan<S>;
+            } else {
+                node.op = Operation::Asterisk;
+                children.push_back(builder.node<S>());
+            }
+        }
+    };
+
+    template<typename S>
+    struct Lower<Commit<S>> {
+        template<class B, class I>
+        static void fill(GraphBuilder &builder, GraphNode &node, std::vector<uint32_t> &children) {
+            node.op = Operation::Commit;
+            // the committed rule memoizes under the identity of the commit
+            node.memoized = false;
+            children.push_back(builder.node<S, I>());
+        }
+    };
+
+    template<class B, class I>
+    uint32_t GraphBuilder::node() {
+        auto key = std::make_pair(std::type_index(typeid(B)), std::type_index(typeid(I)));
+        auto found = indices.find(key);
+        if (found != indices.end()) {
+            return found->second;
+        }
+        auto index = static_cast<uint32_t>(graph.nodes.size());
+        indices.emplace(key, index);
+        graph.nodes.emplace_back();
+        GraphNode node{};
+        node.memoized = I::memo_policy::value;
+        node.nullable = nullable<B>();
+        node.first = first_set<B>();
+        node.id = rule_id<I>();
+        std::vector<uint32_t> children;
+        if constexpr (Named<B>::value && lexical<B>()) {
+            node.op = Operation::Lex;
+            node.lex = &parser::lex<B>;
+        } else {
+            Lower<typename B::definition>::template fill<B, I>(*this, node, children);
+        }
+        node.edges = static_cast<uint32_t>(graph.edges.size());
+        node.children = static_cast<uint32_t>(children.size());
+        graph.edges.insert(graph.edges.end(), children.begin(), children.end());
+        graph.nodes[index] = node;
+        return index;
+    }
+
+    /*!
+     * @tparam Rule root grammar rule.
+     * @return the graph of a root rule, lowered on first use.
+     */
+    template<class Rule>
+    const RuleGraph &rule_graph() {
+        static const RuleGraph graph = [] {
+            GraphBuilder builder;
+            auto root = builder.node<Rule>();
+            return builder.build(root);
+        }();
+        return graph;
+    }
+
+    /*!
+     * Run a rule graph from the start of a text with an explicit stack of continuations.
+     * @param graph lowered grammar.
+     * @param session parse session owning the tree.
+     * @param text source input.
+     * @return the tree, or nullptr if the text does not match.
+     */
+    TreePtr parse_graph(const RuleGraph &graph, ParseSession &session, std::string_view text);
+
+    /*!
+     * Parse a text without recursion. Produces the same tree as the virtual match of the root rule, with the same
+     * memory table, cuts and commit callback, but the combinators in progress are frames on a heap stack instead
+     * of native calls, so the nesting depth of the input is only bounded by memory. Rules of unknown kind still
+     * recurse through their own match. The profiler is not fed. The budget of the session is enforced: set it
+     * with ParseSession::limit and read the progress with ParseSession::report.
+     * @tparam Rule root grammar rule.
+     * @param session parse session owning the tree.
+     * @param text source input.
+     * @return the tree, or nullptr if the text does not match.
+     */
+    template<class Rule>
+    TreePtr parse_iterative(ParseSession &session, std::string_view text) {
+        return parse_graph(rule_graph<Rule>(), session, text);
+    }
+}
+
+#endif //FRONTEND_ITERATIVE_H
@@ -0,0 +1,528 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#ifndef FRONTEND_LEXER_H
+#define FRONTEND_LEXER_H
+
+#include "grammar.h"
+#include "scan.h"
+#include <array>
+#include <utility>
+
+namespace parser {
+
+    /*!
+     * The Glushkov class. Position automaton of a regular combinator, built at compile time.
+     * Every Char and CharRange occurrence is a position; the automaton moves from a position to one of its
+     * followers on a byte of the follower's set.
+     */
+    struct Glushkov {
+        static constexpr size_t capacity = 64;
+        CharSet sets[capacity]{};
+        /*!
+         * Followers of every position, as position masks.
+         */
+        uint64_t follow[capacity]{};
+        uint64_t first = 0;
+        uint64_t last = 0;
+        size_t count = 0;
+        bool nullable = false;
+        /*!
+         * Whether the combinator is regular, fits the capacity and matches as a deterministic automaton.
+         */
+        bool valid = true;
+
+        constexpr uint64_t position(const CharSet &set) {
+            if (count == capacity) {
+                valid = false;
+                return 0;
+            }
+            sets[count] = set;
+            return uint64_t{1} << count++;
+        }
+
+        constexpr void link(uint64_t from, uint64_t to) {
+            for (size_t i = 0; i < count; ++i) {
+                if (from >> i & 1u) {
+                    follow[i] |= to;
+                }
+            }
+        }
+
+        /*!
+         * @param positions position mask.
+         * @return whether the sets of the positions are pairwise disjoint, so that a byte selects at most one.
+         */
+        [[nodiscard]] constexpr bool disjoint(uint64_t positions) const {
+            CharSet seen{};
+            for (size_t i = 0; i < count; ++i) {
+                if (positions >> i & 1u) {
+                    for (size_t j = 0; j < 4; ++j) {
+                        if (seen.bits[j] & sets[i].bits[j]) {
+                            return false;
+                        }
+                    }
+                    seen = seen | sets[i];
+                }
+            }
+            return true;
+        }
+    };
+
+    /*!
+     * A sub-automaton: its entry and exit positions and whether it accepts the empty input.
+     */
+    struct Fragment {
+        uint64_t first = 0;
+        uint64_t last = 0;
+        bool nullable = false;
+    };
+
+    /*!
+     * Compile-time construction of the position automaton of a combinator. Specialized for Char, CharRange, Seq,
+     * Ord, Optional, Plus and Asterisk; other rules are expanded through their definition, up to a nesting depth
+     * that stops recursive rules. `value` tells whether the combinator only uses these, and `build` clears `valid`
+     * wherever ordered choice or greedy repetition would not behave as the automaton: a nullable alternative before
+     * the last one, or a nullable repetition body.
+     * @tparam D combinator type.
+     * @tparam Depth nesting depth.
+     */
+    template<class D, size_t Depth = 0>
+    struct Regular;
+
+    struct Irregular {
+        static constexpr bool value = false;
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            automaton.valid = false;
+            return {};
+        }
+    };
+
+    constexpr size_t regular_depth = 32;
+
+    template<class D, size_t Depth>
+    struct Regular : std::conditional_t<std::is_same_v<typename D::definition, D> || Depth >= regular_depth,
+            Irregular, Regular<typename D::definition, Depth + 1>> {
+    };
+
+    template<char C, size_t Depth>
+    struct Regular<Char<C>, Depth> {
+        static constexpr bool value = true;
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto position = automaton.position(CharSet::range(C, C));
+            return {position, position, false};
+        }
+    };
+
+    template<char Begin, char End, size_t Depth>
+    struct Regular<CharRange<Begin, End>, Depth> {
+        static constexpr bool value = true;
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto position = automaton.position(Begin <= End ? CharSet::range(Begin, End) : CharSet{});
+            return {position, position, false};
+        }
+    };
+
+    template<typename Head, typename ...Tail, size_t Depth>
+    struct Regular<Seq<Head, Tail...>, Depth> {
+        static constexpr bool value = (Regular<Head, Depth + 1>::value && ... && Regular<Tail, Depth + 1>::value);
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto result = Regular<Head, Depth + 1>::build(automaton);
+            auto append = [&](Fragment next) {
+                automaton.link(result.last, next.first);
+                result.first |= result.nullable ? next.first : 0;
+                result.last = next.nullable ? result.last | next.last : next.last;
+                result.nullable &= next.nullable;
+            };
+            (append(Regular<Tail, Depth + 1>::build(automaton)), ...);
+            return result;
+        }
+    };
+
+    template<typename Head, typename ...Tail, size_t Depth>
+    struct Regular<Ord<Head, Tail...>, Depth> {
+        static constexpr bool value = (Regular<Head, Depth + 1>::value && ... && Regular<Tail, Depth + 1>::value);
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto result = Regular<Head, Depth + 1>::build(automaton);
+            auto alternative = [&](Fragment next) {
+                // a nullable alternative always succeeds, the ones after it are never tried
+                automaton.valid &= !result.nullable;
+                result.first |= next.first;
+                result.last |= next.last;
+                result.nullable = next.nullable;
+            };
+            (alternative(Regular<Tail, Depth + 1>::build(automaton)), ...);
+            return result;
+        }
+    };
+
+    template<typename S, size_t Depth>
+    struct Regular<Optional<S>, Depth> {
+        static constexpr bool value = Regular<S, Depth + 1>::value;
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto result = Regular<S, Depth + 1>::build(automaton);
+            result.nullable = true;
+            return result;
+        }
+    };
+
+    template<typename S, size_t Depth>
+    struct Regular<Plus<S>, Depth> {
+        static constexpr bool value = Regular<S, Depth + 1>::value;
+
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto result = Regular<S, Depth + 1>::build(automaton);
+            automaton.valid &= !result.nullable;
+            automaton.link(result.last, result.first);
+            return result;
+        }
+    };
+
+    template<typename S, size_t Depth>
+    struct Regular<Asterisk<S>, Depth> : Regular<Plus<S>, Depth> {
+        static constexpr Fragment build(Glushkov &automaton) {
+            auto result = Regular<Plus<S>, Depth>::build(automaton);
+            result.nullable = true;
+            return result;
+        }
+    };
+
+    /*!
+     * Build the position automaton of a combinator and check that it is deterministic. A deterministic automaton
+     * never has two ways to continue, so the PEG match is its longest accepted prefix: where the PEG would
+     * backtrack out of an optional part, the automaton stops at a dead state and the last accepted prefix is the
+     * same one.
+     * @tparam D combinator type.
+     * @return the automaton; invalid if the combinator cannot be matched as one.
+     */
+    template<class D>
+    constexpr Glushkov glushkov() {
+        Glushkov automaton{};
+        if constexpr (!Regular<D>::value) {
+            automaton.valid = false;
+            return automaton;
+        }
+        auto fragment = Regular<D>::build(automaton);
+        automaton.first = fragment.first;
+        automaton.last = fragment.last;
+        automaton.nullable = fragment.nullable;
+        automaton.valid &= automaton.disjoint(automaton.first);
+        for (size_t i = 0; i < automaton.count; ++i) {
+            automaton.valid &= automaton.disjoint(automaton.follow[i]);
+        }
+        return automaton;
+    }
+
+    template<class D>
+    constexpr Glushkov automaton_of = glushkov<D>();
+
+    /*!
+     * The Dfa class. Minimal deterministic automaton equivalent to a Glushkov automaton: the position states, the
+     * start and a dead state, with equivalent states merged. State 0 is the start.
+     */
+    struct Dfa {
+        static constexpr size_t capacity = Glushkov::capacity + 2;
+        uint8_t next[capacity * 256]{};
+        bool accepting[capacity]{};
+        size_t states = 0;
+        size_t dead = 0;
+    };
+
+    /*!
+     * Turn a valid Glushkov automaton into its minimal Dfa with Moore's partition refinement.
+     * @param automaton deterministic position automaton.
+     * @return the automaton with equivalent states merged.
+     */
+    constexpr Dfa minimize(const Glushkov &automaton) {
+        // bytes that belong to the same positions behave the same, refine over one sample byte of each class
+        uint8_t byte_class[256]{};
+        unsigned sample[256]{};
+        size_t classes = 0;
+        for (unsigned c = 0; c < 256; ++c) {
+            size_t k = 0;
+            for (; k < classes; ++k) {
+                bool same = true;
+                for (size_t i = 0; i < automaton.count && same; ++i) {
+                    same = automaton.sets[i].contains(c) == automaton.sets[i].contains(sample[k]);
+                }
+                if (same) {
+                    break;
+                }
+            }
+            if (k == classes) {
+                sample[classes++] = c;
+            }
+            byte_class[c] = static_cast<uint8_t>(k);
+        }
+        // unminimized states: the start, one state after every position and the dead state
+        const size_t states = automaton.count + 2, dead = states - 1;
+        uint8_t next[Dfa::capacity * 256]{};
+        bool accepting[Dfa::capacity]{};
+        for (size_t state = 0; state < states; ++state) {
+            auto successors = state == dead ? 0 : state ? automaton.follow[state - 1] : automaton.first;
+            for (size_t k = 0; k < classes; ++k) {
+                size_t target = dead;
+                for (size_t i = 0; i < automaton.count; ++i) {
+                    if (successors >> i & 1u && automaton.sets[i].contains(sample[k])) {
+                        target = i + 1;
+                    }
+                }
+                next[state * 256 + k] = static_cast<uint8_t>(target);
+            }
+            accepting[state] = state == dead ? false : state ? automaton.last >> (state - 1) & 1u : automaton.nullable;
+        }
+        size_t block[Dfa::capacity]{}, blocks = 0;
+        bool any[2]{};
+        for (size_t state = 0; state < states; ++state) {
+            block[state] = accepting[state];
+            any[accepting[state]] = true;
+        }
+        blocks = any[0] + any[1];
+        for (;;) {
+            size_t refined[Dfa::capacity]{}, count = 0;
+            for (size_t state = 0; state < states; ++state) {
+                size_t same = 0;
+                for (; same < state; ++same) {
+                    bool equivalent = block[same] == block[state];
+                    for (size_t k = 0; k < classes && equivalent; ++k) {
+                        equivalent = block[next[same * 256 + k]] == block[next[state * 256 + k]];
+                    }
+                    if (equivalent) {
+                        break;
+                    }
+                }
+                refined[state] = same < state ? refined[same] : count++;
+            }
+            for (size_t state = 0; state < states; ++state) {
+                block[state] = refined[state];
+            }
+            if (count == blocks) {
+                break;
+            }
+            blocks = count;
+        }
+        Dfa dfa{};
+        dfa.states = blocks;
+        dfa.dead = block[dead];
+        for (size_t state = 0; state < states; ++state) {
+            for (unsigned c = 0; c < 256; ++c) {
+                dfa.next[block[state] * 256 + c] = static_cast<uint8_t>(block[next[state * 256 + byte_class[c]]]);
+            }
+            dfa.accepting[block[state]] = accepting[state];
+        }
+        return dfa;
+    }
+
+    template<class D>
+    constexpr Dfa dfa_of = minimize(automaton_of<D>);
+
+    template<class D>
+    struct Lexer;
+
+    /*!
+     * Byte class of the self-loop of a Lexer state, so that runs through the state are matched by scan().
+     * @tparam D combinator type of the Lexer.
+     * @tparam State looping state.
+     */
+    template<class D, size_t State>
+    struct Loop {
+        using definition = Loop;
+    };
+
+    template<class D, size_t State>
+    struct Lookahead<Loop<D, State>> {
+        static constexpr CharSet first() { return Lexer<D>::tables.loops[State]; }
+
+        static constexpr bool nullable() { return false; }
+    };
+
+    template<class D, size_t State>
+    struct ByteClass<Loop<D, State>> : std::true_type {
+    };
+
+    /*!
+     * The Lexer class. Transition tables of the minimal automaton of a regular combinator.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct Lexer {
+        static constexpr const Dfa &dfa = dfa_of<D>;
+        static constexpr size_t states = dfa.states;
+        static constexpr size_t dead = dfa.dead;
+
+        struct Tables {
+            std::array<uint8_t, states * 256> next{};
+            std::array<bool, states> accepting{};
+            /*!
+             * Accepting states without transitions: the match ends there without reading another byte.
+             */
+            std::array<bool, states> final{};
+            /*!
+             * Bytes on which a state goes back to itself.
+             */
+            std::array<CharSet, states> loops{};
+        };
+
+        static constexpr Tables build() {
+            Tables tables{};
+            for (size_t state = 0; state < states; ++state) {
+                bool leaves = false;
+                for (unsigned c = 0; c < 256; ++c) {
+                    auto target = dfa.next[state * 256 + c];
+                    tables.next[state * 256 + c] = target;
+                    leaves |= target != dead;
+                    if (target == state && state != dead) {
+                        tables.loops[state] = tables.loops[state] | CharSet::range(c, c);
+                    }
+                }
+                tables.accepting[state] = dfa.accepting[state];
+                tables.final[state] = dfa.accepting[state] && !leaves;
+            }
+            return tables;
+        }
+
+        static constexpr Tables tables = build();
+
+        using Run = size_t (*)(std::string_view, size_t);
+
+        template<size_t State>
+        static constexpr Run run() {
+            if constexpr (tables.loops[State].empty()) {
+                return nullptr;
+            } else {
+                return &scan<Loop<D, State>>;
+            }
+        }
+
+        template<size_t ...State>
+        static constexpr std::array<Run, states> runs(std::index_sequence<State...>) {
+            return {run<State>()...};
+        }
+
+        /*!
+         * Scanner of the self-loop of every state, nullptr for states without one.
+         */
+        static constexpr std::array<Run, states> scanners = runs(std::make_index_sequence<states>{});
+    };
+
+    /*!
+     * Compile-time check of whether a combinator is a repetition of a byte class, which scan() matches without
+     * an automaton.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct ByteRun : std::false_type {
+    };
+
+    template<typename S>
+    struct ByteRun<Plus<S>> : std::integral_constant<bool, byte_class<S>()> {
+    };
+
+    template<typename S>
+    struct ByteRun<Asterisk<S>> : std::integral_constant<bool, byte_class<S>()> {
+    };
+
+    /*!
+     * Compile-time check of whether a rule is matched by a Lexer. Holds for rules whose definition has a valid
+     * automaton, except byte runs.
+     * @tparam T grammar rule.
+     */
+    template<class T>
+    constexpr bool lexical() {
+        using D = typename T::definition;
+        if constexpr (ByteRun<D>::value || !Regular<D>::value) {
+            return false;
+        } else {
+            return automaton_of<D>.valid;
+        }
+    }
+
+    /*!
+     * Match a lexical rule with its automaton: one table lookup per byte, and one scan() per run through a
+     * looping state.
+     * @tparam T grammar rule.
+     * @param text source input.
+     * @param position start position.
+     * @param examined receives the end of the examined input, exclusive.
+     * @return matched length, or no_match.
+     */
+    template<class T>
+    size_t lex(std::string_view text, size_t position, size_t &examined) {
+        using L = Lexer<typename T::definition>;
+        auto &tables = L::tables;
+        size_t state = 0, length = tables.accepting[0] ? 0 : no_match, i = position;
+        while (!tables.final[state]) {
+            if (auto run = L::scanners[state]) {
+                i += run(text, i);
+                if (tables.accepting[state]) {
+                    length = i - position;
+                }
+            }
+            if (i == text.size()) {
+                // the end of the input is examined as well
+                i++;
+                break;
+            }
+            state = tables.next[state * 256 + static_cast<unsigned char>(text[i++])];
+            if (state == L::dead) {
+                break;
+            }
+            if (tables.accepting[state]) {
+                length = i - position;
+            }
+        }
+        examined = i;
+        return length;
+    }
+
+    template<class T>
+    size_t lex(std::string_view text, size_t position) {
+        size_t examined;
+        return lex<T>(text, position, examined);
+    }
+
+    /*!
+     * Combinator a static engine runs for a lexical rule, in place of its definition.
+     * @tparam T grammar rule.
+     */
+    template<class T>
+    struct Lexeme {
+    };
+
+    template<class T, class = void>
+    struct Named : std::false_type {
+    };
+
+    /*!
+     * Rules declared with RULE and keywords match through match_rule.
+     */
+    template<class T>
+    struct Named<T, std::void_t<typename T::rule_type>> : std::true_type {
+    };
+
+    /*!
+     * Combinator a static engine runs for a rule: Lexeme<T> for named lexical rules, the definition otherwise,
+     * so that the static engines build the same trees as the virtual one.
+     * @tparam T grammar rule.
+     */
+    template<class T>
+    constexpr bool named_lexical() {
+        if constexpr (Named<T>::value) {
+            return lexical<T>();
+        } else {
+            return false;
+        }
+    }
+
+    template<class T>
+    using definition_t = std::conditional_t<named_lexical<T>(), Lexeme<T>, typename T::definition>;
+}
+
+#endif //FRONTEND_LEXER_H
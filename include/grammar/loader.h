@@ -0,0 +1,92 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#ifndef FRONTEND_LOADER_H
+#define FRONTEND_LOADER_H
+
+#include "iterative.h"
+#include <optional>
+
+namespace parser {
+
+    /*!
+     * Identity of the rules of loaded grammars, by rule index. Loaded grammars share these types, so a tree from
+     * a loaded grammar has to be read together with that grammar.
+     * @tparam Index rule index in its grammar.
+     */
+    template<size_t Index>
+    struct LoadedRule {
+    };
+
+    /*!
+     * Identity of the anonymous expressions of loaded grammars.
+     */
+    struct LoadedExpression {
+    };
+
+    /*!
+     * The LoadedGrammar class. A grammar read from text at runtime, lowered to the graph of the iterative engine.
+     */
+    struct LoadedGrammar {
+        /*!
+         * Maximum number of rules.
+         */
+        static constexpr size_t capacity = 256;
+        RuleGraph graph{};
+        std::vector<std::string> names{};
+        /*!
+         * Graph node of every rule.
+         */
+        std::vector<uint32_t> rules{};
+
+        /*!
+         * @param name rule name.
+         * @return the rule id of the tree nodes of a rule, or nullopt if there is no such rule.
+         */
+        [[nodiscard]] std::optional<size_t> rule(std::string_view name) const;
+
+        /*!
+         * @param rule rule id of a tree node.
+         * @return the name of the rule of the node, or an empty string for anonymous expressions.
+         */
+        [[nodiscard]] std::string_view name(size_t rule) const;
+
+        /*!
+         * Choose the root rule. Defaults to the first rule of the text.
+         * @param name rule name.
+         * @return whether the rule exists.
+         */
+        bool start(std::string_view name);
+    };
+
+    /*!
+     * Load a PEG grammar from text. Rules are `Name <- expression` for memoized rules, `Name <~ expression` for
+     * transient ones and `Name <= expression` for memoized rules wrapped in Commit. Expressions use `/` for ordered
+     * choice, juxtaposition for sequences, the suffixes `*`, `+` and `?`, the prefix `!`, parentheses, rule names,
+     * literals in single or double quotes, byte classes in brackets (with `^` for the complement), `.` for any
+     * byte, `^` for the start and `$` for the end of the input. Literals and classes accept the escapes \\n, \\r,
+     * \\t, \\v, \\\\ and \\ followed by the delimiter. Comments run from `#` to the end of the line.
+     * Expressions build the tree nodes of the matching template combinators, except that multi-byte literals and
+     * classes of several ranges match as one leaf, like keywords, and regular rules are not lexed as a whole.
+     * @param source grammar text.
+     * @param error receives a description of the first problem, with its line, when loading fails.
+     * @return the grammar, or nullopt if the text is malformed, uses an undefined rule, defines a rule twice,
+     * has more than LoadedGrammar::capacity rules, defines a rule as a cycle of rule names, repeats an expression
+     * that matches the empty string, or has a left recursive rule; the engine would never finish on those.
+     */
+    std::optional<LoadedGrammar> load_grammar(std::string_view source, std::string &error);
+
+    /*!
+     * Parse a text with a loaded grammar. Same engine, memory table and tree shape as parse_iterative.
+     * @param grammar loaded grammar.
+     * @param session parse session owning the tree.
+     * @param text source input.
+     * @return the tree, or nullptr if the text does not match.
+     */
+    inline TreePtr parse_loaded(const LoadedGrammar &grammar, ParseSession &session, std::string_view text) {
+        return parse_graph(grammar.graph, session, text);
+    }
+}
+
+#endif //FRONTEND_LOADER_H
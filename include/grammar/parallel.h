@@ -0,0 +1,101 @@
+//
+// Created by schrodinger on 2/9/21.
+//
+
+#ifndef FRONTEND_PARALLEL_H
+#define FRONTEND_PARALLEL_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+#include "batch.h"
+
+namespace parser {
+
+    /*!
+     * Find candidate start positions of repeated units, such as statements, without parsing.
+     * A candidate follows a terminator outside parentheses, skipped forward to the first byte that may start a unit.
+     * Candidates are only hints: a wrong one costs wasted work, never a wrong result.
+     * @param text source input.
+     * @param first bytes a unit may start with.
+     * @param terminator byte ending a unit.
+     * @return candidate positions, in increasing order.
+     */
+    std::vector<size_t> unit_boundaries(std::string_view text, const CharSet &first, char terminator);
+
+    /*!
+     * Parse a text whose bulk is a repetition of independent units, such as the Plus<Stmt> body of a program,
+     * on the workers of a pool.
+     * The text is cut into chunks at candidate unit boundaries. Workers claim chunks from the pool and parse them
+     * as runs of units, each worker with its own session. The matched units are then seeded into the memory table
+     * of the given session and Rule is parsed sequentially, so the repetition is stitched from memoized units. A
+     * unit depends only on the text from its start position, so a seeded entry is exactly what the sequential
+     * parse would compute there; where a speculative boundary was wrong, the sequential parse finds no entry and
+     * parses on its own until it falls in step with a seeded unit again.
+     * @tparam Rule root grammar rule.
+     * @tparam Unit repeated unit; it must be memoized.
+     * @param pool worker pool; a pool of one worker parses sequentially. The worker sessions are reset, and their
+     * trees are adopted by the arena of the given session.
+     * @param session parse session owning the result. It must not stream.
+     * @param text source input.
+     * @param terminator byte ending a unit.
+     * @return the tree, or nullptr if the text does not match.
+     */
+    template<class Rule, class Unit>
+    TreePtr parse_parallel(ParsePool &pool, const std::shared_ptr<ParseSession> &session, std::string_view text,
+                           char terminator = ';') {
+        static_assert(Unit::memo_policy::value, "parallel units must be memoized");
+        auto threads = pool.size();
+        if (threads <= 1) {
+            return Rule().match(PContext{session, text, 0, 0});
+        }
+        struct Entry {
+            size_t position;
+            TreePtr tree;
+            size_t reach;
+        };
+        auto candidates = unit_boundaries(text, first_set<Unit>(), terminator);
+        auto chunk_size = std::max<size_t>(text.size() / (threads * 16), 16u << 10u);
+        std::vector<size_t> chunks;
+        for (auto position : candidates) {
+            if (chunks.empty() || position - chunks.back() >= chunk_size) {
+                chunks.push_back(position);
+            }
+        }
+        std::vector<std::vector<Entry>> results(chunks.size());
+        for (size_t worker = 0; worker < threads; ++worker) {
+            pool.session(worker)->reset();
+        }
+        auto job = [&](size_t worker, size_t index) {
+            auto &local = pool.session(worker);
+            auto position = chunks[index];
+            auto end = index + 1 < chunks.size() ? chunks[index + 1] : text.size();
+            while (position < end) {
+                local->frontier = position;
+                auto tree = Unit().match(PContext{local, text, position, 0});
+                if (!tree || tree->parsed_region.empty()) {
+                    break;
+                }
+                results[index].push_back({position, tree, local->frontier});
+                position += tree->parsed_region.size();
+            }
+        };
+        pool.run(chunks.size(), job);
+        auto unit = rule_id<Unit>();
+        for (auto &chunk : results) {
+            for (auto &entry : chunk) {
+                session->table.insert({entry.position, unit}, entry.tree, entry.reach);
+            }
+        }
+        for (size_t worker = 0; worker < threads; ++worker) {
+            session->arena.adopt(pool.session(worker)->arena);
+        }
+        // seeded units must survive the cuts of the sequential pass
+        auto keep_memo = session->keep_memo;
+        session->keep_memo = true;
+        auto tree = Rule().match(PContext{session, text, 0, 0});
+        session->keep_memo = keep_memo;
+        return tree;
+    }
+}
+
+#endif //FRONTEND_PARALLEL_H
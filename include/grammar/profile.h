@@ -0,0 +1,190 @@
+//
+// Created by schrodinger on 2/11/21.
+//
+
+#ifndef FRONTEND_PROFILE_H
+#define FRONTEND_PROFILE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace parser {
+    class ProfileScope;
+
+    /*!
+     * The RuleProfile class. Statistics of one grammar rule over a parse.
+     */
+    struct RuleProfile {
+        /*!
+         * Number of match calls.
+         */
+        size_t invocations = 0;
+        /*!
+         * Calls answered by the memory table.
+         */
+        size_t hits = 0;
+        /*!
+         * Calls of memoized rules that had to be evaluated.
+         */
+        size_t misses = 0;
+        /*!
+         * Evaluated calls that matched.
+         */
+        size_t successes = 0;
+        /*!
+         * Evaluated calls that failed.
+         */
+        size_t failures = 0;
+        /*!
+         * Bytes consumed by the successful calls.
+         */
+        size_t bytes = 0;
+        /*!
+         * Time spent in the rule and the rules it called, recursive calls counted once.
+         */
+        uint64_t inclusive_ns = 0;
+        /*!
+         * Time spent in the rule itself.
+         */
+        uint64_t exclusive_ns = 0;
+        /*!
+         * Largest amount of input examined by a failed call, which the parser had to give up.
+         */
+        size_t max_backtrack = 0;
+    };
+
+    /*!
+     * The Profiler class. Per-rule statistics of a parse session, collected when the parser is built with
+     * GRAMMAR_PROFILE.
+     */
+    class Profiler {
+        friend class ProfileScope;
+
+        std::vector<RuleProfile> rules{};
+        std::vector<uint32_t> active{};
+        ProfileScope *current = nullptr;
+
+        RuleProfile &rule(size_t id) {
+            if (id >= rules.size()) {
+                rules.resize(id + 1);
+                active.resize(id + 1);
+            }
+            return rules[id];
+        }
+
+    public:
+        /*!
+         * @return statistics indexed by rule id.
+         */
+        [[nodiscard]] const std::vector<RuleProfile> &statistics() const {
+            return rules;
+        }
+
+        /*!
+         * Drop all statistics.
+         */
+        void clear();
+
+        /*!
+         * Print the rules sorted by exclusive time.
+         * @param out output stream.
+         * @param limit maximal number of rules to print, 0 for all.
+         */
+        void report(std::ostream &out, size_t limit = 0) const;
+    };
+
+    /*!
+     * The ProfileScope class. Measures one match call, from its construction to its destruction.
+     * The scope tracks the input examined by the call on the session frontier, exactly like a memoized rule does,
+     * so profiling does not change what the memory table records.
+     */
+    class ProfileScope {
+        using Clock = std::chrono::steady_clock;
+
+        Profiler &profiler;
+        size_t &frontier;
+        size_t id;
+        size_t position;
+        size_t saved;
+        ProfileScope *parent;
+        uint64_t children = 0;
+        bool failed = false;
+        Clock::time_point begin;
+
+    public:
+        /*!
+         * Start measuring a call.
+         * @param profiler session profiler.
+         * @param frontier session frontier.
+         * @param id rule id.
+         * @param position start position.
+         */
+        ProfileScope(Profiler &profiler, size_t &frontier, size_t id, size_t position)
+                : profiler(profiler), frontier(frontier), id(id), position(position), saved(frontier),
+                  parent(profiler.current) {
+            profiler.rule(id).invocations++;
+            profiler.active[id]++;
+            profiler.current = this;
+            frontier = position;
+            begin = Clock::now();
+        }
+
+        ProfileScope(const ProfileScope &) = delete;
+
+        ProfileScope &operator=(const ProfileScope &) = delete;
+
+        ~ProfileScope() {
+            auto elapsed = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+            auto &rule = profiler.rules[id];
+            if (--profiler.active[id] == 0) {
+                rule.inclusive_ns += elapsed;
+            }
+            rule.exclusive_ns += elapsed - std::min(elapsed, children);
+            if (failed) {
+                rule.max_backtrack = std::max(rule.max_backtrack, frontier - position);
+            }
+            if (parent) {
+                parent->children += elapsed;
+            }
+            profiler.current = parent;
+            frontier = std::max(frontier, saved);
+        }
+
+        /*!
+         * Record a memo hit.
+         */
+        void hit() {
+            profiler.rules[id].hits++;
+        }
+
+        /*!
+         * Record a memo miss.
+         */
+        void miss() {
+            profiler.rules[id].misses++;
+        }
+
+        /*!
+         * Record the result of an evaluated call.
+         * @param success whether the call matched.
+         * @param length consumed bytes.
+         */
+        void result(bool success, size_t length) {
+            auto &rule = profiler.rules[id];
+            if (success) {
+                rule.successes++;
+                rule.bytes += length;
+            } else {
+                rule.failures++;
+                failed = true;
+            }
+        }
+    };
+}
+
+#endif //FRONTEND_PROFILE_H
@@ -0,0 +1,290 @@
+//
+// Created by schrodinger on 2/12/21.
+//
+
+#ifndef FRONTEND_RECOGNIZE_H
+#define FRONTEND_RECOGNIZE_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+
+namespace parser {
+
+    /*!
+     * The LengthTable class. Packrat memory of the recognizer, keeping only match lengths.
+     * Each column is indexed by position and holds 0 for unknown entries, 1 for failures and length + 2 for
+     * successes.
+     */
+    class LengthTable {
+        std::vector<std::vector<uint32_t>> columns{};
+        size_t base = 0;
+    public:
+        /*!
+         * Look up a memoized length.
+         * @param key memoization key.
+         * @param length receives the memoized length, or no_match for a memoized failure.
+         * @return whether the key is present.
+         */
+        bool find(const MemoKey &key, size_t &length) const {
+            if (key.second >= columns.size() || key.first < base) {
+                return false;
+            }
+            auto &column = columns[key.second];
+            auto index = key.first - base;
+            if (index >= column.size() || !column[index]) {
+                return false;
+            }
+            length = column[index] == 1 ? no_match : column[index] - 2;
+            return true;
+        }
+
+        /*!
+         * Memoize a length.
+         * @param key memoization key.
+         * @param length matched length, or no_match for a failure.
+         */
+        void insert(const MemoKey &key, size_t length);
+
+        /*!
+         * Drop all entries and ignore every position before a cut from now on.
+         * @param position cut position.
+         */
+        void retire(size_t position);
+    };
+
+    /*!
+     * The Recognizer class. State of a recognize-only parse: the grammar templates are run through their
+     * definitions at compile time and return match lengths, without building trees.
+     * Rules of unknown kind are parsed by their own match function in a private session.
+     */
+    struct Recognizer {
+        /*!
+         * Source input.
+         */
+        std::string_view text;
+        /*!
+         * Memory table.
+         */
+        LengthTable table{};
+        /*!
+         * Session for the rules of unknown kind, created on first use.
+         */
+        std::shared_ptr<ParseSession> fallback{};
+
+        explicit Recognizer(std::string_view text) : text(text) {}
+
+        /*!
+         * Match a rule, going through the memory table according to its memo_policy.
+         * @tparam T grammar rule.
+         * @param position start position.
+         * @return matched length, or no_match.
+         */
+        template<class T>
+        size_t match(size_t position);
+    };
+
+    /*!
+     * Recognize-only semantics of a combinator. Specialized for every builtin combinator; the primary template
+     * handles rules of unknown kind.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct Recognize {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            if (!recognizer.fallback) {
+                recognizer.fallback = std::make_shared<ParseSession>();
+            }
+            auto tree = T().match(PContext{recognizer.fallback, recognizer.text, position, 0});
+            return tree ? tree->parsed_region.size() : no_match;
+        }
+    };
+
+    template<class T>
+    size_t Recognizer::match(size_t position) {
+        if constexpr (T::memo_policy::value) {
+            size_t length;
+            MemoKey key{position, rule_id<T>()};
+            if (table.find(key, length)) {
+                return length;
+            }
+            length = Recognize<definition_t<T>>::template match<T>(*this, position);
+            table.insert(key, length);
+            return length;
+        } else {
+            return Recognize<definition_t<T>>::template match<T>(*this, position);
+        }
+    }
+
+    template<>
+    struct Recognize<Start> {
+        template<class T>
+        static size_t match(Recognizer &, size_t position) {
+            return position == 0 ? 0 : no_match;
+        }
+    };
+
+    template<>
+    struct Recognize<End> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return position == recognizer.text.size() ? 0 : no_match;
+        }
+    };
+
+    template<>
+    struct Recognize<Nothing> {
+        template<class T>
+        static size_t match(Recognizer &, size_t) {
+            return 0;
+        }
+    };
+
+    template<>
+    struct Recognize<Any> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return position < recognizer.text.size() ? 1 : no_match;
+        }
+    };
+
+    template<char C>
+    struct Recognize<Char<C>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return position < recognizer.text.size() && recognizer.text[position] == C ? 1 : no_match;
+        }
+    };
+
+    template<char Begin, char End>
+    struct Recognize<CharRange<Begin, End>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return position < recognizer.text.size() && recognizer.text[position] >= Begin &&
+                   recognizer.text[position] <= End ? 1 : no_match;
+        }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Recognize<Seq<Head, Tail...>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            size_t total = 0;
+            auto step = [&](size_t length) {
+                total += length;
+                return length != no_match;
+            };
+            auto matched = step(recognizer.match<Head>(position)) &&
+                           (step(recognizer.match<Tail>(position + total)) && ...);
+            return matched ? total : no_match;
+        }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Recognize<Ord<Head, Tail...>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            size_t length = no_match;
+            auto attempt = [&](auto *rule) {
+                using Rule = std::remove_pointer_t<decltype(rule)>;
+                return may_start<Rule>(recognizer.text, position) &&
+                       (length = recognizer.match<Rule>(position)) != no_match;
+            };
+            attempt(static_cast<Head *>(nullptr)) || (attempt(static_cast<Tail *>(nullptr)) || ...);
+            return length;
+        }
+    };
+
+    template<typename S>
+    struct Recognize<Optional<S>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            auto length = may_start<S>(recognizer.text, position) ? recognizer.match<S>(position) : no_match;
+            return length == no_match ? 0 : length;
+        }
+    };
+
+    template<typename S>
+    struct Recognize<Not<S>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return recognizer.match<S>(position) == no_match ? 0 : no_match;
+        }
+    };
+
+    /*!
+     * Recognize a rule repeatedly.
+     * @tparam S repeated rule.
+     * @param recognizer recognizer state.
+     * @param position start position.
+     * @return total matched length and number of repetitions.
+     */
+    template<typename S>
+    std::pair<size_t, size_t> recognize_repeat(Recognizer &recognizer, size_t position) {
+        if constexpr (byte_class<S>()) {
+            auto length = scan<S>(recognizer.text, position);
+            return {length, length};
+        } else {
+            size_t total = 0, count = 0, length;
+            while (may_start<S>(recognizer.text, position + total) &&
+                   (length = recognizer.match<S>(position + total)) != no_match) {
+                total += length;
+                count++;
+            }
+            return {total, count};
+        }
+    }
+
+    template<typename S>
+    struct Recognize<Plus<S>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            auto result = recognize_repeat<S>(recognizer, position);
+            return result.second ? result.first : no_match;
+        }
+    };
+
+    template<typename S>
+    struct Recognize<Asterisk<S>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return recognize_repeat<S>(recognizer, position).first;
+        }
+    };
+
+    template<typename S>
+    struct Recognize<Commit<S>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            auto length = recognizer.match<S>(position);
+            if (length != no_match) {
+                recognizer.table.retire(position + length);
+            }
+            return length;
+        }
+    };
+
+    template<class L>
+    struct Recognize<Lexeme<L>> {
+        template<class T>
+        static size_t match(Recognizer &recognizer, size_t position) {
+            return lex<L>(recognizer.text, position);
+        }
+    };
+
+    /*!
+     * Recognize a text without building a tree. Runs the same grammar templates as a parse and memoizes only
+     * lengths, retiring the memory table at every cut.
+     * @tparam Rule root grammar rule.
+     * @param text source input.
+     * @param position start position.
+     * @return matched length, or no_match.
+     */
+    template<class Rule>
+    size_t recognize(std::string_view text, size_t position = 0) {
+        Recognizer recognizer{text};
+        return recognizer.match<Rule>(position);
+    }
+}
+
+#endif //FRONTEND_RECOGNIZE_H
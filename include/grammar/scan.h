@@ -0,0 +1,145 @@
+//
+// Created by schrodinger on 2/3/21.
+//
+
+#ifndef FRONTEND_SCAN_H
+#define FRONTEND_SCAN_H
+
+#include "grammar.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace parser {
+
+    /*!
+     * The ByteRanges class. A byte set split into inclusive ranges, used to build vector membership tests.
+     */
+    struct ByteRanges {
+        static constexpr size_t capacity = 8;
+        unsigned char begin[capacity]{};
+        unsigned char end[capacity]{};
+        /*!
+         * Number of ranges, or capacity + 1 if the set is too fragmented for the vector scanners.
+         */
+        size_t count = 0;
+
+        static constexpr ByteRanges of(const CharSet &set) {
+            ByteRanges ranges{};
+            unsigned i = 0;
+            while (i < 256) {
+                if (!set.contains(i)) {
+                    ++i;
+                    continue;
+                }
+                unsigned j = i;
+                while (j + 1 < 256 && set.contains(j + 1)) {
+                    ++j;
+                }
+                if (ranges.count == capacity) {
+                    ranges.count = capacity + 1;
+                    return ranges;
+                }
+                ranges.begin[ranges.count] = i;
+                ranges.end[ranges.count] = j;
+                ranges.count++;
+                i = j + 1;
+            }
+            return ranges;
+        }
+    };
+
+    namespace scanner {
+        template<class T>
+        constexpr CharSet set = first_set<T>();
+
+        template<class T>
+        constexpr ByteRanges ranges = ByteRanges::of(set<T>);
+
+        template<class T>
+        size_t scalar(const char *data, size_t size, size_t position) {
+            while (position < size && set<T>.contains(static_cast<unsigned char>(data[position]))) {
+                ++position;
+            }
+            return position;
+        }
+
+#if defined(__AVX2__)
+        template<class T, size_t ...I>
+        __m256i member_mask(__m256i block, std::index_sequence<I...>) {
+            auto mask = _mm256_setzero_si256();
+            ((mask = _mm256_or_si256(mask, [block] {
+                auto offset = _mm256_sub_epi8(block, _mm256_set1_epi8(static_cast<char>(ranges<T>.begin[I])));
+                auto width = _mm256_set1_epi8(static_cast<char>(ranges<T>.end[I] - ranges<T>.begin[I]));
+                return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, width), offset);
+            }())), ...);
+            return mask;
+        }
+
+        template<class T>
+        size_t vector(const char *data, size_t size, size_t position) {
+            constexpr auto indices = std::make_index_sequence<ranges<T>.count>{};
+            while (position + 32 <= size) {
+                auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + position));
+                auto miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(member_mask<T>(block, indices)));
+                if (miss) {
+                    return position + __builtin_ctz(miss);
+                }
+                position += 32;
+            }
+            return scalar<T>(data, size, position);
+        }
+#elif defined(__SSE2__)
+        template<class T, size_t ...I>
+        __m128i member_mask(__m128i block, std::index_sequence<I...>) {
+            auto mask = _mm_setzero_si128();
+            ((mask = _mm_or_si128(mask, [block] {
+                auto offset = _mm_sub_epi8(block, _mm_set1_epi8(static_cast<char>(ranges<T>.begin[I])));
+                auto width = _mm_set1_epi8(static_cast<char>(ranges<T>.end[I] - ranges<T>.begin[I]));
+                return _mm_cmpeq_epi8(_mm_min_epu8(offset, width), offset);
+            }())), ...);
+            return mask;
+        }
+
+        template<class T>
+        size_t vector(const char *data, size_t size, size_t position) {
+            constexpr auto indices = std::make_index_sequence<ranges<T>.count>{};
+            while (position + 16 <= size) {
+                auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + position));
+                auto miss = ~static_cast<uint32_t>(_mm_movemask_epi8(member_mask<T>(block, indices))) & 0xffffu;
+                if (miss) {
+                    return position + __builtin_ctz(miss);
+                }
+                position += 16;
+            }
+            return scalar<T>(data, size, position);
+        }
+#else
+        template<class T>
+        size_t vector(const char *data, size_t size, size_t position) {
+            return scalar<T>(data, size, position);
+        }
+#endif
+    }
+
+    /*!
+     * Measure the run of bytes from a byte class starting at a position.
+     * Uses AVX2 or SSE2 when available and the class splits into few ranges, scalar code otherwise.
+     * @tparam T byte class rule.
+     * @param text source input.
+     * @param position start position.
+     * @return length of the run.
+     */
+    template<class T>
+    size_t scan(std::string_view text, size_t position) {
+        static_assert(byte_class<T>(), "only byte classes can be scanned");
+        if constexpr (scanner::ranges<T>.count <= ByteRanges::capacity) {
+            return scanner::vector<T>(text.data(), text.size(), position) - position;
+        } else {
+            return scanner::scalar<T>(text.data(), text.size(), position) - position;
+        }
+    }
+}
+
+#endif //FRONTEND_SCAN_H
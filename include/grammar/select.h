@@ -0,0 +1,392 @@
+//
+// Created by schrodinger on 2/13/21.
+//
+
+#ifndef FRONTEND_SELECT_H
+#define FRONTEND_SELECT_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+
+namespace parser {
+
+    /*!
+     * The Builder class. State of a parse that only materialises the rules active in a selector.
+     * The grammar templates are run through their definitions at compile time. Nodes of active rules are pushed on
+     * the session stack; silent rules leave the nodes of their active descendants there, so they end up spliced
+     * into the nearest active ancestor.
+     * @tparam S selector; `S::selects<T>()` tells at compile time whether rule T is active.
+     */
+    template<class S>
+    struct Builder {
+        using selector = S;
+
+        /*!
+         * Parse session holding the memory table, the arena and the node stack.
+         */
+        ParseSession &session;
+        /*!
+         * Source input.
+         */
+        std::string_view text;
+        /*!
+         * Session for the rules of unknown kind, created on first use.
+         */
+        std::shared_ptr<ParseSession> fallback{};
+
+        Builder(ParseSession &session, std::string_view text) : session(session), text(text) {}
+
+        /*!
+         * Match a rule, going through the memory table according to its memo_policy. On success the selected
+         * nodes of the rule are left on the session stack.
+         * @tparam T grammar rule.
+         * @param position start position.
+         * @return matched length, or no_match.
+         */
+        template<class T>
+        size_t match(size_t position);
+
+        /*!
+         * Memoize the result of a rule, unless the budget is exhausted and the result may come from refused
+         * invocations.
+         * @param key memoization key.
+         * @param tree memoized node, or nullptr for a failure.
+         */
+        void memoize(const MemoKey &key, TreePtr tree) {
+            if (session.progress.exhausted == Exhausted::None) {
+                session.table.insert(key, tree);
+            }
+        }
+
+        /*!
+         * @return a mark to rewind the nodes produced from now on.
+         */
+        [[nodiscard]] size_t mark() const {
+            return session.stack.size();
+        }
+
+        /*!
+         * Drop the nodes produced since a mark.
+         * @param mark value returned by mark().
+         */
+        void rewind(size_t mark) {
+            session.stack.resize(mark);
+        }
+
+        /*!
+         * Handle a cut declared with Commit.
+         * @param position cut position.
+         */
+        void cut(size_t position) {
+            if (!session.keep_memo) {
+                session.table.retire(position);
+            }
+        }
+
+        /*!
+         * Add the selected nodes of a tree parsed by a virtual match function.
+         * @param tree matched tree.
+         */
+        void splice(TreePtr tree) {
+            for (auto i : tree->subtrees()) {
+                for (auto j : i->template compress<S>(session.arena)) {
+                    session.stack.push_back(j);
+                }
+            }
+        }
+    };
+
+    /*!
+     * Selected-tree semantics of a combinator. Specialized for every builtin combinator; the primary template
+     * handles rules of unknown kind by splicing the tree of their own match function.
+     * The specializations only talk to the engine through match, mark, rewind, cut, splice, text and fallback,
+     * so they serve every engine with that interface, not only Builder.
+     * @tparam D combinator type.
+     */
+    template<class D>
+    struct Build {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            if (!builder.fallback) {
+                builder.fallback = std::make_shared<ParseSession>();
+            }
+            auto tree = T().match(PContext{builder.fallback, builder.text, position, 0});
+            if (!tree) {
+                return no_match;
+            }
+            builder.splice(tree);
+            return tree->parsed_region.size();
+        }
+    };
+
+    template<class S>
+    template<class T>
+    size_t Builder<S>::match(size_t position) {
+        constexpr bool memoized = T::memo_policy::value;
+        constexpr bool selected = S::template selects<T>();
+        MemoKey key{position, rule_id<T>()};
+        if (!session.proceed(position, rule_id<T>())) {
+            return no_match;
+        }
+        auto &stack = session.stack;
+        if constexpr (memoized) {
+            if (auto memo = session.table.find(key)) {
+                if (!memo->tree) {
+                    return no_match;
+                }
+                if constexpr (selected) {
+                    stack.push_back(memo->tree);
+                } else {
+                    stack.insert(stack.end(), memo->tree->subtrees().begin(), memo->tree->subtrees().end());
+                }
+                return memo->length;
+            }
+        }
+        auto mark = stack.size();
+        auto length = Build<definition_t<T>>::template match<T>(*this, position);
+        if (length == no_match) {
+            stack.resize(mark);
+            if constexpr (memoized) {
+                memoize(key, nullptr);
+            }
+            return no_match;
+        }
+        if constexpr (selected) {
+            auto tree = session.arena.tree(text.substr(position, length), rule_id<T>(), session.collect(mark));
+            stack.push_back(tree);
+            if constexpr (memoized) {
+                memoize(key, tree);
+            }
+        } else if constexpr (memoized) {
+            // silent rules are memoized as a node grouping their selected descendants
+            auto group = session.arena.span(stack.data() + mark, stack.size() - mark);
+            memoize(key, session.arena.tree(text.substr(position, length), rule_id<T>(), group));
+        }
+        return length;
+    }
+
+    template<>
+    struct Build<Start> {
+        template<class T, class B>
+        static size_t match(B &, size_t position) {
+            return position == 0 ? 0 : no_match;
+        }
+    };
+
+    template<>
+    struct Build<End> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return position == builder.text.size() ? 0 : no_match;
+        }
+    };
+
+    template<>
+    struct Build<Nothing> {
+        template<class T, class B>
+        static size_t match(B &, size_t) {
+            return 0;
+        }
+    };
+
+    template<>
+    struct Build<Any> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return position < builder.text.size() ? 1 : no_match;
+        }
+    };
+
+    template<char C>
+    struct Build<Char<C>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return position < builder.text.size() && builder.text[position] == C ? 1 : no_match;
+        }
+    };
+
+    template<char Begin, char End>
+    struct Build<CharRange<Begin, End>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return position < builder.text.size() && builder.text[position] >= Begin &&
+                   builder.text[position] <= End ? 1 : no_match;
+        }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Build<Seq<Head, Tail...>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            size_t total = 0;
+            auto step = [&](size_t length) {
+                total += length;
+                return length != no_match;
+            };
+            auto matched = step(builder.template match<Head>(position)) &&
+                           (step(builder.template match<Tail>(position + total)) && ...);
+            return matched ? total : no_match;
+        }
+    };
+
+    template<typename Head, typename ...Tail>
+    struct Build<Ord<Head, Tail...>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            size_t length = no_match;
+            auto attempt = [&](auto *rule) {
+                using Rule = std::remove_pointer_t<decltype(rule)>;
+                return may_start<Rule>(builder.text, position) &&
+                       (length = builder.template match<Rule>(position)) != no_match;
+            };
+            attempt(static_cast<Head *>(nullptr)) || (attempt(static_cast<Tail *>(nullptr)) || ...);
+            return length;
+        }
+    };
+
+    template<typename S>
+    struct Build<Optional<S>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            auto length = may_start<S>(builder.text, position) ? builder.template match<S>(position) : no_match;
+            return length == no_match ? 0 : length;
+        }
+    };
+
+    template<typename S>
+    struct Build<Not<S>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            auto mark = builder.mark();
+            auto length = builder.template match<S>(position);
+            builder.rewind(mark);
+            return length == no_match ? 0 : no_match;
+        }
+    };
+
+    /*!
+     * Match a rule repeatedly in a selected-tree parse.
+     * @tparam S repeated rule.
+     * @tparam B builder type.
+     * @param builder builder state.
+     * @param position start position.
+     * @return total matched length and number of repetitions.
+     */
+    template<typename S, class B>
+    std::pair<size_t, size_t> build_repeat(B &builder, size_t position) {
+        if constexpr (byte_class<S>()) {
+            auto length = scan<S>(builder.text, position);
+            return {length, length};
+        } else {
+            size_t total = 0, count = 0, length;
+            while (may_start<S>(builder.text, position + total) &&
+                   (length = builder.template match<S>(position + total)) != no_match) {
+                total += length;
+                count++;
+            }
+            return {total, count};
+        }
+    }
+
+    template<typename S>
+    struct Build<Plus<S>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            auto result = build_repeat<S>(builder, position);
+            return result.second ? result.first : no_match;
+        }
+    };
+
+    template<typename S>
+    struct Build<Asterisk<S>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return build_repeat<S>(builder, position).first;
+        }
+    };
+
+    template<typename S>
+    struct Build<Commit<S>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            auto length = Build<definition_t<S>>::template match<T>(builder, position);
+            if (length != no_match) {
+                builder.cut(position + length);
+            }
+            return length;
+        }
+    };
+
+    template<class L>
+    struct Build<Lexeme<L>> {
+        template<class T, class B>
+        static size_t match(B &builder, size_t position) {
+            return lex<L>(builder.text, position);
+        }
+    };
+
+    /*!
+     * Parse a text into the tree that compress<S>() would produce, in one pass: silent rules never materialise
+     * nodes. Selector membership is resolved at compile time.
+     * Cuts retire the memory table as in an ordinary parse. The commit callback is never called, and the
+     * examined input is not tracked, so memo entries have no reach: the session must not be incremental
+     * (keep_memo) or streaming (on_commit). The budget of the session is enforced: set it with ParseSession::limit and
+     * read the progress with ParseSession::report. A rule of unknown kind counts as one invocation, and the rules
+     * it calls run on a session of their own.
+     * @tparam Rule root grammar rule. Its node is always materialised.
+     * @tparam S selector marking the active rules.
+     * @param session parse session owning the tree.
+     * @param text source input.
+     * @return the root node, whose subtrees are the selected nodes, or nullptr if the text does not match.
+     */
+    template<class Rule, class S>
+    TreePtr parse_selected(ParseSession &session, std::string_view text) {
+        Builder<S> builder{session, text};
+        auto mark = session.stack.size();
+        auto length = builder.template match<Rule>(0);
+        if (length == no_match) {
+            return nullptr;
+        }
+        if constexpr (S::template selects<Rule>()) {
+            auto tree = session.stack.back();
+            session.stack.resize(mark);
+            return tree;
+        } else {
+            return session.arena.tree(text.substr(0, length), rule_id<Rule>(), session.collect(mark));
+        }
+    }
+
+    /*!
+     * Selector marking every rule as active.
+     */
+    struct Everything {
+        template<class T>
+        static constexpr bool selects() {
+            return true;
+        }
+
+        bool operator()(size_t) const {
+            return true;
+        }
+    };
+
+    /*!
+     * Parse a text with static dispatch. Produces the same tree as the virtual match of the root rule, but rules
+     * are called as templates on a session reference instead of through virtual match calls on temporaries with
+     * a copied context, so whole Seq, Ord and Keyword chains can be inlined.
+     * The bookkeeping of the virtual match is only partly kept, as in parse_selected: the budget is enforced, but
+     * the examined input is not tracked, so memo entries have no reach; the commit callback is never called; and
+     * the profiler is not fed. It must not be used on incremental sessions (keep_memo), whose table edits rely
+     * on the reach, nor on streaming sessions (on_commit).
+     * @tparam Rule root grammar rule.
+     * @param session parse session owning the tree.
+     * @param text source input.
+     * @return the tree, or nullptr if the text does not match.
+     */
+    template<class Rule>
+    TreePtr parse_static(ParseSession &session, std::string_view text) {
+        return parse_selected<Rule, Everything>(session, text);
+    }
+}
+
+#endif //FRONTEND_SELECT_H
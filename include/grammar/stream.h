@@ -0,0 +1,100 @@
+//
+// Created by schrodinger on 2/5/21.
+//
+
+#ifndef FRONTEND_STREAM_H
+#define FRONTEND_STREAM_H
+
+#include "grammar.h"
+#include "grammar.ipp"
+
+namespace parser {
+
+    /*!
+     * The MappedFile class. A read-only memory mapping of a whole file.
+     * Pages are mapped lazily by the kernel, and pages behind a cut can be dropped again with release().
+     */
+    class MappedFile {
+        const char *data = nullptr;
+        size_t size = 0;
+        size_t released = 0;
+
+    public:
+        MappedFile() = default;
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        MappedFile(MappedFile &&that) noexcept;
+
+        MappedFile &operator=(MappedFile &&that) noexcept;
+
+        ~MappedFile();
+
+        /*!
+         * Map a file, replacing the current mapping.
+         * @param path file path.
+         * @return whether the file is mapped.
+         */
+        bool open(const std::string &path);
+
+        /*!
+         * Unmap the file.
+         */
+        void close();
+
+        /*!
+         * @return the mapped content.
+         */
+        [[nodiscard]] std::string_view text() const {
+            return {data, size};
+        }
+
+        /*!
+         * Tell the kernel that the pages before a position will not be read again.
+         * @param position cut position.
+         */
+        void release(size_t position);
+    };
+
+    /*!
+     * Parse a text in streaming mode. Every tree matched by a Commit rule is handed to the callback as soon as it
+     * is committed; its nodes and all memoized entries are released afterwards, so memory stays bounded by the
+     * largest committed unit rather than by the input.
+     * @tparam Rule root grammar rule.
+     * @tparam Callback callable taking a TreePtr.
+     * @param text source input.
+     * @param callback commit callback. Trees passed to it are only valid during the call.
+     * @return whether the root rule matched.
+     */
+    template<class Rule, class Callback>
+    bool stream(std::string_view text, Callback &&callback) {
+        PContext context{std::make_shared<ParseSession>(), text, 0, 0};
+        context.session->on_commit = std::forward<Callback>(callback);
+        return Rule().match(context) != nullptr;
+    }
+
+    /*!
+     * Parse a file in streaming mode through a memory mapping, dropping pages behind each cut.
+     * @tparam Rule root grammar rule.
+     * @tparam Callback callable taking a TreePtr.
+     * @param path file path.
+     * @param callback commit callback. Trees passed to it are only valid during the call.
+     * @return whether the file could be mapped and the root rule matched.
+     */
+    template<class Rule, class Callback>
+    bool stream_file(const std::string &path, Callback &&callback) {
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        auto text = file.text();
+        return stream<Rule>(text, [&](TreePtr tree) {
+            callback(tree);
+            file.release(tree->parsed_region.data() - text.data());
+        });
+    }
+}
+
+#endif //FRONTEND_STREAM_H
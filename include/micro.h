@@ -1,6 +1,13 @@
 
-#include "grammar.h"
-#include "grammar.ipp"
+//
+// Created by schrodinger on 1/21/21.
+//
+
+#ifndef FRONTEND_MICRO_H
+#define FRONTEND_MICRO_H
+
+#include "grammar/grammar.h"
+#include "grammar/grammar.ipp"
 
 namespace grammar {
     struct Primary;
@@ -9,7 +16,7 @@ namespace grammar {
     struct Expr;
     using namespace parser;
 
-    RULE(Op, Ord<Char<'+'>, Char<'-'>>)
+    POLICY_RULE(Op, Transient, Ord<Char<'+'>, Char<'-'>>)
 
     RULE(MicroBegin, Keyword<'b', 'e', 'g', 'i', 'n'>)
 
@@ -19,17 +26,17 @@ namespace grammar {
 
     RULE(Write, Keyword<'w', 'r', 'i', 't', 'e'>)
 
-    RULE(Alpha, Ord<CharRange<'a', 'z'>, CharRange<'A', 'Z'>>)
+    POLICY_RULE(Alpha, Transient, Ord<CharRange<'a', 'z'>, CharRange<'A', 'Z'>>)
 
-    RULE(Digit, CharRange<'0', '9'>)
+    POLICY_RULE(Digit, Transient, CharRange<'0', '9'>)
 
     RULE(Integer, Plus<Digit>)
 
-    RULE(ASCII, Ord<Alpha, Digit, Char<'_'>>)
+    POLICY_RULE(ASCII, Transient, Ord<Alpha, Digit, Char<'_'>>)
 
     RULE(Identity, Seq<Ord<Alpha, Char<'_'>>, Asterisk<ASCII>>)
 
-    RULE(AssignmentOp, Seq<Char<':'>, Char<'='>>)
+    POLICY_RULE(AssignmentOp, Transient, Seq<Char<':'>, Char<'='>>)
 
     RULE(Assignment, SpaceInterleaved<Identity, AssignmentOp, Expr>)
 
@@ -45,10 +52,12 @@ namespace grammar {
 
     RULE(Expr, Ord<SpaceInterleaved<Primary, Asterisk<SpaceInterleaved<Op, Primary>>>>)
 
-    RULE(Stmt, SpaceInterleaved<Ord<ReadStmt, WriteStmt, Assignment>, Char<';'>>)
+    RULE(Stmt, Commit<SpaceInterleaved<Ord<ReadStmt, WriteStmt, Assignment>, Char<';'>>>)
 
     RULE(Toplevel, SpaceInterleaved<Start, MicroBegin, Plus<Stmt>, MicroEnd, End>)
 
     using SelectRule = Selector<Toplevel, ReadStmt, WriteStmt, Expr, Primary, Identity, Assignment, Integer, Op>;
 
 }
+
+#endif //FRONTEND_MICRO_H
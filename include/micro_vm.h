@@ -0,0 +1,103 @@
+//
+// Created by schrodinger on 2/17/21.
+//
+
+#ifndef FRONTEND_MICRO_VM_H
+#define FRONTEND_MICRO_VM_H
+
+#include "micro.h"
+#include <optional>
+
+namespace micro {
+
+    /*!
+     * Operations of the micro register machine.
+     */
+    enum class Opcode : uint8_t {
+        /*!
+         * target := left
+         */
+        Move,
+        /*!
+         * target := left + right
+         */
+        Add,
+        /*!
+         * target := left - right
+         */
+        Sub,
+        /*!
+         * target := next input value
+         */
+        Read,
+        /*!
+         * append left to the output
+         */
+        Write,
+        /*!
+         * stop the program
+         */
+        Halt
+    };
+
+    /*!
+     * The Instruction class. One register machine instruction; unused operands are 0.
+     */
+    struct Instruction {
+        Opcode op;
+        uint32_t target;
+        uint32_t left;
+        uint32_t right;
+    };
+
+    /*!
+     * The Program class. Bytecode of a micro program.
+     * The registers hold the variables first, then the constants, then the temporaries of the expressions. The
+     * constant registers are loaded once before the code runs, so the code never loads an immediate.
+     */
+    struct Program {
+        std::vector<Instruction> code{};
+        /*!
+         * Values of the constant registers.
+         */
+        std::vector<int64_t> constants{};
+        /*!
+         * Names of the variable registers.
+         */
+        std::vector<std::string> variables{};
+        /*!
+         * Total number of registers.
+         */
+        uint32_t registers = 0;
+    };
+
+    /*!
+     * Lower a micro program to bytecode. Variables are resolved to registers with a SymTable at compile time;
+     * a variable that is never assigned reads as 0.
+     * @param toplevel Toplevel node of the tree compressed with grammar::SelectRule.
+     * @return the program, or nullopt if the tree does not have the expected shape.
+     */
+    std::optional<Program> compile(parser::TreePtr toplevel);
+
+    /*!
+     * Run a compiled program.
+     * @param program bytecode.
+     * @param input values consumed by read statements.
+     * @param output receives the values of write statements.
+     * @return whether the program ran to the end; false if it read past the input.
+     */
+    bool execute(const Program &program, const std::vector<int64_t> &input, std::vector<int64_t> &output);
+
+    /*!
+     * Run a micro program by walking its tree, looking every variable up by name. Reference semantics for the
+     * bytecode.
+     * @param toplevel Toplevel node of the tree compressed with grammar::SelectRule.
+     * @param input values consumed by read statements.
+     * @param output receives the values of write statements.
+     * @return whether the program ran to the end; false if it read past the input or the tree has an
+     * unexpected shape.
+     */
+    bool evaluate(parser::TreePtr toplevel, const std::vector<int64_t> &input, std::vector<int64_t> &output);
+}
+
+#endif //FRONTEND_MICRO_VM_H
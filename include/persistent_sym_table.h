@@ -0,0 +1,312 @@
+//
+// Created by schrodinger on 2/16/21.
+//
+
+#ifndef FRONTEND_PERSISTENT_SYM_TABLE_H
+#define FRONTEND_PERSISTENT_SYM_TABLE_H
+
+#include "sym_table.h"
+#include <memory>
+
+namespace symtable {
+
+    /*!
+     * The PersistentSymTable class. A symbol table with scoping support whose state is immutable and shared.
+     * Symbols map to their shadow chains through a hash array mapped trie indexed by the symbol id; every change
+     * copies the path to the changed entry and shares the rest. The undo log of the open scopes is a shared list
+     * as well, so a copy of the table is an O(1) snapshot that can enter, escape and update independently, and
+     * const access to a table is safe from any number of threads.
+     * Names are interned beforehand with an Interner, for example the one of a SymTable; the table only sees
+     * Symbols.
+     * Scoping follows SymTable: definitions are undone at the escape of their scope, and local updates that
+     * shadow an enclosing definition are carried over to it.
+     * @tparam Value symbol type.
+     */
+    template<class Value>
+    class PersistentSymTable {
+        /*!
+         * A definition in the shadow chain of a symbol.
+         */
+        struct Definition {
+            size_t level;
+            Value value;
+            std::shared_ptr<const Definition> shadowed;
+        };
+
+        using Chain = std::shared_ptr<const Definition>;
+
+        struct Node;
+
+        using NodePtr = std::shared_ptr<const Node>;
+
+        /*!
+         * A trie slot: either a subtree or the chain of one symbol.
+         */
+        struct Slot {
+            uint32_t key;
+            Chain chain;
+            NodePtr child;
+        };
+
+        /*!
+         * A trie node. Slot i is present when bit i of the bitmap is set and is stored at the rank of that bit.
+         */
+        struct Node {
+            uint32_t bitmap = 0;
+            std::vector<Slot> slots{};
+        };
+
+        enum class Action : uint8_t {
+            Define, Shadow, Update
+        };
+
+        struct Undo {
+            Symbol symbol;
+            Action action;
+            std::shared_ptr<const Undo> next;
+        };
+
+        using Log = std::shared_ptr<const Undo>;
+
+        struct Scope {
+            Log log;
+            std::shared_ptr<const Scope> next;
+        };
+
+        static constexpr uint32_t bits = 5;
+        static constexpr uint32_t mask = (1u << bits) - 1;
+
+        NodePtr root{};
+        Log log{};
+        std::shared_ptr<const Scope> scopes{};
+        size_t level{};
+
+        static uint32_t fragment(uint32_t key, uint32_t shift) {
+            return (key >> shift) & mask;
+        }
+
+        static uint32_t rank(uint32_t bitmap, uint32_t bit) {
+            return static_cast<uint32_t>(__builtin_popcount(bitmap & ((1u << bit) - 1)));
+        }
+
+        static const Chain &lookup(const NodePtr &node, uint32_t key) {
+            static const Chain missing{};
+            auto current = node.get();
+            for (uint32_t shift = 0; current; shift += bits) {
+                auto bit = fragment(key, shift);
+                if (!(current->bitmap & (1u << bit))) {
+                    break;
+                }
+                auto &slot = current->slots[rank(current->bitmap, bit)];
+                if (!slot.child) {
+                    return slot.key == key ? slot.chain : missing;
+                }
+                current = slot.child.get();
+            }
+            return missing;
+        }
+
+        /*!
+         * Copy the path to a key, storing a chain there, or removing the key for a null chain.
+         */
+        static NodePtr assign(const NodePtr &node, uint32_t key, Chain chain, uint32_t shift) {
+            auto bit = fragment(key, shift);
+            auto present = node && (node->bitmap & (1u << bit));
+            if (!present) {
+                if (!chain) {
+                    return node;
+                }
+                auto result = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+                result->slots.insert(result->slots.begin() + rank(result->bitmap, bit),
+                                     Slot{key, std::move(chain), nullptr});
+                result->bitmap |= 1u << bit;
+                return result;
+            }
+            auto index = rank(node->bitmap, bit);
+            auto &slot = node->slots[index];
+            if (!slot.child && slot.key != key && !chain) {
+                return node;
+            }
+            auto result = std::make_shared<Node>(*node);
+            if (slot.child) {
+                auto child = assign(slot.child, key, std::move(chain), shift + bits);
+                if (child) {
+                    result->slots[index].child = std::move(child);
+                    return result;
+                }
+            } else if (slot.key == key) {
+                if (chain) {
+                    result->slots[index].chain = std::move(chain);
+                    return result;
+                }
+            } else {
+                // two keys share the prefix so far: push the resident one down
+                auto child = assign(nullptr, slot.key, slot.chain, shift + bits);
+                result->slots[index] = Slot{0, nullptr, assign(child, key, std::move(chain), shift + bits)};
+                return result;
+            }
+            result->slots.erase(result->slots.begin() + index);
+            result->bitmap &= ~(1u << bit);
+            return result->bitmap ? NodePtr{std::move(result)} : nullptr;
+        }
+
+        void set(Symbol symbol, Chain chain) {
+            root = assign(root, symbol.id, std::move(chain), 0);
+        }
+
+        void record(Symbol symbol, Action action) {
+            if (scopes) {
+                log = std::make_shared<const Undo>(Undo{symbol, action, std::move(log)});
+            }
+        }
+
+    public:
+        PersistentSymTable() = default;
+
+        PersistentSymTable(const PersistentSymTable &) = default;
+
+        PersistentSymTable(PersistentSymTable &&) noexcept = default;
+
+        PersistentSymTable &operator=(const PersistentSymTable &) = default;
+
+        PersistentSymTable &operator=(PersistentSymTable &&) noexcept = default;
+
+        ~PersistentSymTable() {
+            // unlink an unshared log iteratively, long logs would otherwise be freed by nested destructors
+            while (log && log.use_count() == 1) {
+                auto next = log->next;
+                log = std::move(next);
+            }
+        }
+
+        /*!
+         * @return an independent copy of the table, in O(1).
+         */
+        [[nodiscard]] PersistentSymTable snapshot() const {
+            return *this;
+        }
+
+        /*!
+         * Enter a new scope.
+         */
+        void enter() {
+            scopes = std::make_shared<const Scope>(Scope{log, std::move(scopes)});
+            level++;
+        }
+
+        /*!
+         * Create a new symbol.
+         * @tparam Args symbol constructor argument.
+         * @param symbol interned symbol.
+         * @param args symbol arguments.
+         * @return whether the new definition overwrites a previous symbol.
+         */
+        template<class ...Args>
+        bool define(Symbol symbol, Args &&... args) {
+            auto &current = lookup(root, symbol.id);
+            if (current && current->level >= level) {
+                return false;
+            }
+            set(symbol, std::make_shared<const Definition>(
+                    Definition{level, Value(std::forward<Args>(args)...), current}));
+            record(symbol, Action::Define);
+            return true;
+        }
+
+        /*!
+         * Update a value associated with the symbol in the inner most scope.
+         * @tparam Args symbol constructor argument.
+         * @param symbol interned symbol.
+         * @param keep update the visible definition in place, without recording a local update.
+         * @param args symbol arguments.
+         * @return whether the symbol is defined.
+         */
+        template<class ...Args>
+        bool update(Symbol symbol, bool keep, Args &&... args) {
+            auto current = lookup(root, symbol.id);
+            if (!current) {
+                return false;
+            } else if (!keep && current->level < level) {
+                set(symbol, std::make_shared<const Definition>(
+                        Definition{level, Value(std::forward<Args>(args)...), current}));
+                record(symbol, Action::Shadow);
+            } else {
+                set(symbol, std::make_shared<const Definition>(
+                        Definition{current->level, Value(std::forward<Args>(args)...), current->shadowed}));
+                if (!keep) record(symbol, Action::Update);
+            }
+            return true;
+        }
+
+        /*!
+         * Find a symbol.
+         * @param symbol interned symbol.
+         * @return the visible value, or nullptr if the symbol is not defined. The value lives as long as any
+         * table sharing it.
+         */
+        [[nodiscard]] const Value *find(Symbol symbol) const {
+            auto &current = lookup(root, symbol.id);
+            return current ? &current->value : nullptr;
+        }
+
+        /*!
+         * Find a symbol.
+         * @param symbol locate the symbol.
+         * @return an optional structure contains the value.
+         */
+        std::optional<Value> operator()(Symbol symbol) const {
+            if (auto value = find(symbol)) {
+                return *value;
+            }
+            return std::nullopt;
+        }
+
+        [[nodiscard]] bool defined_same_scope(Symbol symbol) const {
+            auto &current = lookup(root, symbol.id);
+            return current && current->level == level;
+        }
+
+        /*!
+         * Escape the current scope.
+         */
+        void escape() {
+            auto mark = scopes->log;
+            scopes = scopes->next;
+            while (log != mark) {
+                auto symbol = log->symbol;
+                auto action = log->action;
+                log = log->next;
+                if (action == Action::Update) {
+                    continue;
+                }
+                auto current = lookup(root, symbol.id);
+                auto &shadowed = current->shadowed;
+                if (action == Action::Shadow) {
+                    set(symbol, std::make_shared<const Definition>(
+                            Definition{shadowed->level, current->value, shadowed->shadowed}));
+                } else {
+                    set(symbol, shadowed);
+                }
+            }
+            level--;
+        }
+
+        /*!
+         * Collect the local updates of the current scope.
+         * @tparam Collection associative container from Symbol to Value.
+         * @return the updated symbols with their current values.
+         */
+        template<class Collection>
+        Collection local_updates() const {
+            Collection collection{};
+            for (auto i = log.get(); i != scopes->log.get(); i = i->next.get()) {
+                if (i->action != Action::Define) {
+                    collection.insert(std::make_pair(i->symbol, *find(i->symbol)));
+                }
+            }
+            return collection;
+        }
+    };
+}
+
+#endif //FRONTEND_PERSISTENT_SYM_TABLE_H
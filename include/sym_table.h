@@ -5,155 +5,353 @@
 #ifndef FRONTEND_SYM_TABLE_H
 #define FRONTEND_SYM_TABLE_H
 
+#include <cstdint>
+#include <deque>
 #include <unordered_map>
 #include <vector>
 #include <string>
-#include <stack>
+#include <string_view>
+#include <optional>
 
 namespace symtable {
     template<class Value>
     using SymDef = std::pair<size_t, Value>;
 
+    /*!
+     * The Symbol class. Dense id of an interned name.
+     */
+    struct Symbol {
+        uint32_t id;
+
+        bool operator==(Symbol that) const {
+            return id == that.id;
+        }
+
+        bool operator!=(Symbol that) const {
+            return id != that.id;
+        }
+
+        bool operator<(Symbol that) const {
+            return id < that.id;
+        }
+    };
+
+    /*!
+     * The Interner class. Maps names to dense ids. Names are hashed once when they are interned or looked up;
+     * everything keyed by a Symbol afterwards is plain indexing.
+     */
+    class Interner {
+        std::deque<std::string> names{};
+        std::unordered_map<std::string_view, uint32_t> ids{};
+    public:
+        /*!
+         * Intern a name.
+         * @param name symbol name, for example the parsed region of an identifier.
+         * @return the id of the name, new if the name was not seen before.
+         */
+        Symbol intern(std::string_view name) {
+            auto iter = ids.find(name);
+            if (iter != ids.end()) {
+                return {iter->second};
+            }
+            auto id = static_cast<uint32_t>(names.size());
+            ids.emplace(names.emplace_back(name), id);
+            return {id};
+        }
+
+        /*!
+         * Look up a name without interning it.
+         * @param name symbol name.
+         * @return the id of the name, or nullopt if it was never interned.
+         */
+        [[nodiscard]] std::optional<Symbol> find(std::string_view name) const {
+            auto iter = ids.find(name);
+            if (iter == ids.end()) {
+                return std::nullopt;
+            }
+            return Symbol{iter->second};
+        }
+
+        /*!
+         * @param symbol interned id.
+         * @return the name of the id.
+         */
+        [[nodiscard]] const std::string &name(Symbol symbol) const {
+            return names[symbol.id];
+        }
+
+        /*!
+         * @return number of interned names.
+         */
+        [[nodiscard]] size_t size() const {
+            return names.size();
+        }
+    };
+
     /*!
      * The SymTable class. A symbol table with scoping support.
+     * Definitions live in one flat array; each symbol has the index of its innermost definition, and every
+     * definition links to the one it shadows. Scopes are undone through a log of the symbols they touched, so
+     * entering and escaping a scope costs O(symbols touched) and never hashes a name.
+     * Every operation takes either a name, which is looked up once in the interner, or an interned Symbol.
      * @tparam Value symbol type.
      */
     template<class Value>
     class SymTable {
+        static constexpr uint32_t none = UINT32_MAX;
+
+        /*!
+         * A definition in the shadow chain of a symbol.
+         */
+        struct Definition {
+            size_t level;
+            uint32_t shadowed;
+            Value value;
+        };
+
         /*!
-         * Symbols defined in the inner most scope, which can be popped away when the scope is escaped.
+         * What a scope did to a symbol: defined it, shadowed it with an update, or updated it in place.
          */
-        std::stack <std::vector<std::string>> local_defined{};
-        std::stack <std::vector<std::string>> local_updated{};
+        enum class Action : uint8_t {
+            Define, Shadow, Update
+        };
 
+        struct Undo {
+            Symbol symbol;
+            Action action;
+        };
 
+        Interner interner{};
+        /*!
+         * Index of the innermost definition of each symbol.
+         */
+        std::vector<uint32_t> heads{};
+        /*!
+         * Definitions, in the order of the scopes that created them.
+         */
+        std::vector<Definition> definitions{};
+        /*!
+         * Undo log of the open scopes.
+         */
+        std::vector<Undo> log{};
         /*!
-         * Symbol table structure.
+         * Log position at the entrance of each open scope.
          */
-        std::unordered_map <std::string, std::stack<SymDef<Value>>> table{};
+        std::vector<size_t> scopes{};
         /*!
          * Scope depth.
          */
         size_t level{};
+
+        uint32_t head(Symbol symbol) const {
+            return symbol.id < heads.size() ? heads[symbol.id] : none;
+        }
+
+        void push(Symbol symbol, Value value) {
+            if (symbol.id >= heads.size()) {
+                heads.resize(interner.size(), none);
+            }
+            definitions.push_back({level, heads[symbol.id], std::move(value)});
+            heads[symbol.id] = static_cast<uint32_t>(definitions.size() - 1);
+        }
+
+        void record(Symbol symbol, Action action) {
+            if (!scopes.empty()) {
+                log.push_back({symbol, action});
+            }
+        }
+
     public:
         /*!
          * Enter a new scope.
          */
         void enter() {
-            local_defined.template emplace();
-            local_updated.template emplace();
+            scopes.push_back(log.size());
             level++;
         }
 
+        /*!
+         * Intern a name.
+         * @param name symbol name.
+         * @return its id, valid for the lifetime of the table.
+         */
+        Symbol intern(std::string_view name) {
+            return interner.intern(name);
+        }
+
+        /*!
+         * @param symbol interned id.
+         * @return the name of the id.
+         */
+        [[nodiscard]] const std::string &name(Symbol symbol) const {
+            return interner.name(symbol);
+        }
+
         /*!
          * Create a new symbol.
          * @tparam Args symbol constructor argument.
-         * @param name symbol name.
+         * @param symbol interned symbol.
          * @param args symbol arguments.
          * @return whether the new definition overwrites a previous symbol.
          */
         template<class ...Args>
-        bool define(std::string name, Args &&... args) {
-            local_defined.top().push_back(name);
-            auto iter = table.find(name);
-            if (iter == table.end()) {
-                table.template insert(std::make_pair(name, std::stack < SymDef<Value>>{}));
-                table.at(name).push(std::make_pair(level, Value(std::forward<Args>(args)...)));
-            } else if (iter->second.top().first >= level) {
+        bool define(Symbol symbol, Args &&... args) {
+            auto current = head(symbol);
+            if (current != none && definitions[current].level >= level) {
                 return false;
-            } else {
-                iter->second.push({level, Value(std::forward<Args>(args)...)});
             }
+            push(symbol, Value(std::forward<Args>(args)...));
+            record(symbol, Action::Define);
             return true;
         }
 
         /*!
-         * Update a value associated with the symbol in the inner most scope.
+         * Create a new symbol.
          * @tparam Args symbol constructor argument.
-         * @param name symbol name
+         * @param name symbol name.
          * @param args symbol arguments.
          * @return whether the new definition overwrites a previous symbol.
          */
         template<class ...Args>
-        bool update(std::string name, bool keep, Args &&... args) {
-            auto iter = table.find(name);
-            if (iter == table.end()) {
+        bool define(std::string_view name, Args &&... args) {
+            return define(interner.intern(name), std::forward<Args>(args)...);
+        }
+
+        /*!
+         * Update a value associated with the symbol in the inner most scope.
+         * Unless keep is set, the update is visible in the current scope as a local update and is carried over
+         * to the enclosing definition when the scope is escaped.
+         * @tparam Args symbol constructor argument.
+         * @param symbol interned symbol.
+         * @param keep update the visible definition in place, without recording a local update.
+         * @param args symbol arguments.
+         * @return whether the symbol is defined.
+         */
+        template<class ...Args>
+        bool update(Symbol symbol, bool keep, Args &&... args) {
+            auto current = head(symbol);
+            if (current == none) {
                 return false;
-            } else if (!keep && iter->second.top().first < level) {
-                iter->second.push(std::make_pair(level, Value(std::forward<Args>(args)...)));
-                local_updated.top().emplace_back(std::move(name));
+            } else if (!keep && definitions[current].level < level) {
+                push(symbol, Value(std::forward<Args>(args)...));
+                record(symbol, Action::Shadow);
             } else {
-                iter->second.top().second = Value(std::forward<Args>(args)...);
-                if(!keep) local_updated.top().emplace_back(std::move(name));
+                definitions[current].value = Value(std::forward<Args>(args)...);
+                if (!keep) record(symbol, Action::Update);
             }
             return true;
         }
 
+        /*!
+         * Update a value associated with the symbol in the inner most scope.
+         * @tparam Args symbol constructor argument.
+         * @param name symbol name.
+         * @param keep update the visible definition in place, without recording a local update.
+         * @param args symbol arguments.
+         * @return whether the symbol is defined.
+         */
+        template<class ...Args>
+        bool update(std::string_view name, bool keep, Args &&... args) {
+            auto symbol = interner.find(name);
+            return symbol && update(*symbol, keep, std::forward<Args>(args)...);
+        }
+
+        /*!
+         * Find a symbol.
+         * @param symbol interned symbol.
+         * @return the visible value, or nullptr if the symbol is not defined.
+         */
+        [[nodiscard]] const Value *find(Symbol symbol) const {
+            auto current = head(symbol);
+            return current == none ? nullptr : &definitions[current].value;
+        }
+
+        /*!
+         * Find a symbol.
+         * @param name symbol name.
+         * @return the visible value, or nullptr if the symbol is not defined.
+         */
+        [[nodiscard]] const Value *find(std::string_view name) const {
+            auto symbol = interner.find(name);
+            return symbol ? find(*symbol) : nullptr;
+        }
+
         /*!
          * Find a symbol.
          * @param name locate the symbol.
          * @return an optional structure contains the value.
          */
-        std::optional <Value>
-        operator()(std::string name) {
-            auto iter = table.find(name);
-            if (iter == table.end()) {
-                return std::nullopt;
-            } else {
-                auto res =  iter->second.top().second;
-                return std::move(res);
+        template<class Name>
+        std::optional<Value> operator()(const Name &name) const {
+            if (auto value = find(name)) {
+                return *value;
             }
+            return std::nullopt;
         }
 
-        bool defined_same_scope(std::string name) {
-            auto iter = table.find(name);
-            if (iter == table.end()) {
-                return false;
-            } else {
-                return iter->second.top().first == level;
-            }
+        template<class Name>
+        bool defined_same_scope(const Name &name) const {
+            auto symbol = lookup(name);
+            auto current = symbol ? head(*symbol) : none;
+            return current != none && definitions[current].level == level;
         }
 
-/*!
- * Escape the current scope.
- */
+        /*!
+         * Escape the current scope.
+         */
         void escape() {
-            auto a = std::move(local_defined.top());
-            local_defined.pop();
-            local_updated.pop();
-            for (const auto &i : a) {
-                auto iter = table.find(i);
-                if (iter == table.end()) continue;
-                if (iter->second.size() <= 1 ) {
-                    table.erase(iter);
-                } else {
-                    iter->second.pop();
+            auto mark = scopes.back();
+            scopes.pop_back();
+            while (log.size() > mark) {
+                auto undo = log.back();
+                log.pop_back();
+                if (undo.action == Action::Update) {
+                    continue;
+                }
+                auto &current = heads[undo.symbol.id];
+                auto shadowed = definitions[current].shadowed;
+                if (undo.action == Action::Shadow) {
+                    definitions[shadowed].value = std::move(definitions[current].value);
                 }
+                current = shadowed;
+            }
+            while (!definitions.empty() && definitions.back().level >= level) {
+                definitions.pop_back();
             }
-//            for (const auto &i : b) {
-//                auto iter = table.find(i);
-//                if (iter == table.end()) continue;
-//                if (iter->second.size() <= 1) {
-//                    table.erase(iter);
-//                } else {
-//                    iter->second.pop();
-//                }
-//            }
-
             level--;
         }
 
         template<class Collection>
-        Collection local_updates() {
+        Collection local_updates() const {
             Collection collection{};
-            for (auto &i : this->local_updated.top()) {
-                collection.insert(std::make_pair(i, table.at(i).top().second));
+            for (auto i = scopes.back(); i < log.size(); ++i) {
+                if (log[i].action != Action::Define) {
+                    collection.insert(std::make_pair(interner.name(log[i].symbol),
+                                                     definitions[heads[log[i].symbol.id]].value));
+                }
             }
             return collection;
         }
 
+    private:
+        std::optional<Symbol> lookup(std::string_view name) const {
+            return interner.find(name);
+        }
+
+        static std::optional<Symbol> lookup(Symbol symbol) {
+            return symbol;
+        }
     };
 }
 
 
+namespace std {
+    template<>
+    struct hash<symtable::Symbol> {
+        size_t operator()(symtable::Symbol symbol) const noexcept {
+            return symbol.id;
+        }
+    };
+}
+
 #endif //FRONTEND_SYM_TABLE_H
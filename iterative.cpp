@@ -0,0 +1,330 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/iterative.h"
+
+namespace {
+    using namespace parser;
+
+    /*!
+     * A combinator in progress. `step` counts the children already called; `cursor` is where the next one starts.
+     */
+    struct Frame {
+        uint32_t node;
+        uint32_t step;
+        size_t position;
+        size_t cursor;
+        /*!
+         * Size of the session stack when the combinator started.
+         */
+        size_t mark;
+    };
+
+    struct Machine {
+        const RuleGraph &graph;
+        ParseSession &session;
+        std::string_view text;
+        /*!
+         * Non-owning handle on the session, for rules of unknown kind.
+         */
+        std::shared_ptr<ParseSession> handle;
+        std::vector<Frame> frames{};
+        /*!
+         * Frontiers of the enclosing rules, one per memoized frame.
+         */
+        std::vector<size_t> frontiers{};
+        /*!
+         * Arena marks, one per commit frame and per repetition of commits streamed to the callback.
+         */
+        std::vector<TreeArena::Mark> marks{};
+        /*!
+         * Result of the last finished rule.
+         */
+        TreePtr result = nullptr;
+
+        Machine(const RuleGraph &graph, ParseSession &session, std::string_view text)
+                : graph(graph), session(session), text(text), handle(std::shared_ptr<void>{}, &session) {}
+
+        TreePtr tree(const GraphNode &node, size_t position, size_t length, TreeSpan subtrees) {
+            return session.arena.tree(text.substr(position, length), node.id, subtrees);
+        }
+
+        bool may_match(uint32_t index, size_t position) {
+            auto &node = graph.nodes[index];
+            if (node.nullable) {
+                return true;
+            }
+            session.examine(position + 1);
+            return position < text.size() && node.first.contains(static_cast<unsigned char>(text[position]));
+        }
+
+        bool streams(const GraphNode &node) const {
+            return (node.op == Operation::Plus || node.op == Operation::Asterisk) && session.on_commit &&
+                   graph.nodes[graph.edges[node.edges]].op == Operation::Commit;
+        }
+
+        /*!
+         * Start a rule: either finish it at once in `result`, or push its frame.
+         */
+        void call(uint32_t index, size_t position) {
+            auto &node = graph.nodes[index];
+            if (!session.proceed(position, node.id)) {
+                result = nullptr;
+                return;
+            }
+            size_t saved = 0;
+            if (node.memoized) {
+                if (auto memo = session.table.find({position, node.id})) {
+                    session.examine(session.table.reach(position));
+                    result = session.reuse(memo->tree, text, position);
+                    return;
+                }
+                saved = session.enter(position);
+            }
+            TreePtr leaf = nullptr;
+            size_t length;
+            switch (node.op) {
+                case Operation::Char:
+                    session.examine(position + 1);
+                    if (position < text.size() && text[position] == node.low) {
+                        leaf = tree(node, position, 1, {});
+                    }
+                    break;
+                case Operation::Range:
+                    session.examine(position + 1);
+                    if (position < text.size() && text[position] >= node.low && text[position] <= node.high) {
+                        leaf = tree(node, position, 1, {});
+                    }
+                    break;
+                case Operation::Any:
+                    session.examine(position + 1);
+                    if (position < text.size()) {
+                        leaf = tree(node, position, 1, {});
+                    }
+                    break;
+                case Operation::Start:
+                    if (position == 0) {
+                        leaf = tree(node, position, 0, {});
+                    }
+                    break;
+                case Operation::End:
+                    session.examine(position + 1);
+                    if (position == text.size()) {
+                        leaf = tree(node, position, 0, {});
+                    }
+                    break;
+                case Operation::Nothing:
+                    leaf = tree(node, position, 0, {});
+                    break;
+                case Operation::Class:
+                    session.examine(position + 1);
+                    if (position < text.size() && node.first.contains(static_cast<unsigned char>(text[position]))) {
+                        leaf = tree(node, position, 1, {});
+                    }
+                    break;
+                case Operation::Literal: {
+                    auto literal = std::string_view{graph.literals}.substr(node.edges, node.children);
+                    length = 0;
+                    while (length < literal.size() && position + length < text.size() &&
+                           text[position + length] == literal[length]) {
+                        length++;
+                    }
+                    session.examine(position + std::min(length + 1, literal.size()));
+                    if (length == literal.size()) {
+                        leaf = tree(node, position, length, {});
+                    }
+                    break;
+                }
+                case Operation::ScanPlus:
+                case Operation::ScanAsterisk:
+                    if (node.scan) {
+                        length = node.scan(text, position);
+                    } else {
+                        length = 0;
+                        while (position + length < text.size() &&
+                               node.first.contains(static_cast<unsigned char>(text[position + length]))) {
+                            length++;
+                        }
+                    }
+                    session.examine(position + length + 1);
+                    if (length || node.op == Operation::ScanAsterisk) {
+                        leaf = tree(node, position, length, {});
+                    }
+                    break;
+                case Operation::Lex: {
+                    size_t examined;
+                    length = node.lex(text, position, examined);
+                    session.examine(examined);
+                    if (length != no_match) {
+                        leaf = tree(node, position, length, {});
+                    }
+                    break;
+                }
+                case Operation::Foreign:
+                    leaf = node.foreign(PContext{handle, text, position, 0});
+                    break;
+                default:
+                    if (node.memoized) {
+                        frontiers.push_back(saved);
+                    }
+                    if (node.op == Operation::Commit || streams(node)) {
+                        marks.push_back(session.arena.mark());
+                    }
+                    frames.push_back({index, 0, position, position, session.stack.size()});
+                    return;
+            }
+            if (node.memoized) {
+                session.memoize({position, node.id}, leaf, saved);
+            }
+            result = leaf;
+        }
+
+        /*!
+         * Finish the frame on top of the stack.
+         */
+        void finish(TreePtr tree) {
+            auto &frame = frames.back();
+            auto &node = graph.nodes[frame.node];
+            if (node.memoized) {
+                session.memoize({frame.position, node.id}, tree, frontiers.back());
+                frontiers.pop_back();
+            }
+            frames.pop_back();
+            result = tree;
+        }
+
+        /*!
+         * Continue the frame on top of the stack; `result` holds its last child unless it has just started.
+         */
+        void resume() {
+            auto &frame = frames.back();
+            auto &node = graph.nodes[frame.node];
+            auto child = [&](uint32_t i) { return graph.edges[node.edges + i]; };
+            switch (node.op) {
+                case Operation::Seq:
+                    if (frame.step) {
+                        if (!result) {
+                            session.stack.resize(frame.mark);
+                            finish(nullptr);
+                            return;
+                        }
+                        session.stack.push_back(result);
+                        frame.cursor += result->parsed_region.size();
+                    }
+                    if (frame.step == node.children) {
+                        finish(tree(node, frame.position, frame.cursor - frame.position, session.collect(frame.mark)));
+                        return;
+                    }
+                    call(child(frame.step++), frame.cursor);
+                    return;
+                case Operation::Ord:
+                    if (frame.step && result) {
+                        finish(tree(node, frame.position, result->parsed_region.size(), session.arena.span({result})));
+                        return;
+                    }
+                    while (frame.step < node.children) {
+                        auto next = child(frame.step++);
+                        if (may_match(next, frame.position)) {
+                            call(next, frame.position);
+                            return;
+                        }
+                    }
+                    finish(nullptr);
+                    return;
+                case Operation::Optional:
+                    if (!frame.step) {
+                        frame.step = 1;
+                        if (may_match(child(0), frame.position)) {
+                            call(child(0), frame.position);
+                            return;
+                        }
+                        result = nullptr;
+                    }
+                    finish(result ? tree(node, frame.position, result->parsed_region.size(),
+                                         session.arena.span({result}))
+                                  : tree(node, frame.position, 0, {}));
+                    return;
+                case Operation::Not:
+                    if (!frame.step) {
+                        frame.step = 1;
+                        call(child(0), frame.position);
+                        return;
+                    }
+                    finish(result ? nullptr : tree(node, frame.position, 0, {}));
+                    return;
+                case Operation::Plus:
+                case Operation::Asterisk: {
+                    // step is one more than the iterations matched so far while an iteration is running
+                    auto streaming = streams(node);
+                    size_t matched = 0;
+                    bool more = true;
+                    if (frame.step) {
+                        matched = frame.step - 1;
+                        if (result) {
+                            matched++;
+                            frame.cursor += result->parsed_region.size();
+                            if (streaming) {
+                                session.arena.release(marks.back());
+                            } else {
+                                session.stack.push_back(result);
+                            }
+                        } else {
+                            more = false;
+                        }
+                    }
+                    if (more && may_match(child(0), frame.cursor)) {
+                        frame.step = static_cast<uint32_t>(matched + 1);
+                        call(child(0), frame.cursor);
+                        return;
+                    }
+                    if (streaming) {
+                        marks.pop_back();
+                    }
+                    if (node.op == Operation::Plus && !matched) {
+                        finish(nullptr);
+                    } else {
+                        finish(tree(node, frame.position, frame.cursor - frame.position, session.collect(frame.mark)));
+                    }
+                    return;
+                }
+                case Operation::Commit: {
+                    if (!frame.step) {
+                        frame.step = 1;
+                        call(child(0), frame.position);
+                        return;
+                    }
+                    auto mark = marks.back();
+                    marks.pop_back();
+                    if (!result) {
+                        finish(nullptr);
+                        return;
+                    }
+                    auto length = result->parsed_region.size();
+                    if (!session.keep_memo) {
+                        session.table.retire(frame.position + length);
+                    }
+                    if (session.on_commit) {
+                        session.on_commit(result);
+                        session.arena.release(mark);
+                        result = tree(node, frame.position, length, {});
+                    }
+                    finish(result);
+                    return;
+                }
+                default:
+                    // leaves never have frames
+                    finish(nullptr);
+            }
+        }
+    };
+}
+
+parser::TreePtr parser::parse_graph(const RuleGraph &graph, ParseSession &session, std::string_view text) {
+    Machine machine{graph, session, text};
+    machine.call(graph.root, 0);
+    while (!machine.frames.empty()) {
+        machine.resume();
+    }
+    return machine.result;
+}
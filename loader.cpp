@@ -0,0 +1,808 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/loader.h"
+#include <algorithm>
+#include <array>
+
+namespace {
+    using namespace parser;
+
+    enum class Kind : uint8_t {
+        Reference, Sequence, Choice, Optional, Not, Plus, Asterisk, Literal, Class, Any, Start, End
+    };
+
+    struct Expression {
+        Kind kind;
+        size_t line;
+        /*!
+         * Bytes of a literal, or name of a reference.
+         */
+        std::string text{};
+        CharSet set{};
+        std::vector<size_t> children{};
+        /*!
+         * Index of the rule whose definition contains the expression.
+         */
+        size_t rule = 0;
+    };
+
+    constexpr size_t anonymous = static_cast<size_t>(-1);
+
+    template<size_t ...Index>
+    std::array<size_t, sizeof...(Index)> loaded_ids(std::index_sequence<Index...>) {
+        return {rule_id<LoadedRule<Index>>()...};
+    }
+
+    size_t loaded_id(size_t index) {
+        static const auto ids = loaded_ids(std::make_index_sequence<LoadedGrammar::capacity>{});
+        return ids[index];
+    }
+
+    bool same(const CharSet &a, const CharSet &b) {
+        return std::equal(std::begin(a.bits), std::end(a.bits), std::begin(b.bits));
+    }
+
+    /*!
+     * Recursive descent reader of the grammar text.
+     */
+    struct Reader {
+        std::string_view source;
+        size_t position = 0;
+        size_t line = 1;
+        std::vector<Expression> expressions{};
+        std::vector<std::string> names{};
+        std::vector<size_t> bodies{};
+        std::vector<bool> memoized{};
+        std::vector<bool> committed{};
+        std::string error{};
+
+        bool fail(const std::string &message) {
+            if (error.empty()) {
+                error = "line " + std::to_string(line) + ": " + message;
+            }
+            return false;
+        }
+
+        void skip() {
+            while (position < source.size()) {
+                auto c = source[position];
+                if (c == '#') {
+                    while (position < source.size() && source[position] != '\n') {
+                        position++;
+                    }
+                } else if (c == '\n') {
+                    line++;
+                    position++;
+                } else if (c == ' ' || c == '\t' || c == '\r') {
+                    position++;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        bool peek(char c) {
+            skip();
+            return position < source.size() && source[position] == c;
+        }
+
+        bool eat(std::string_view token) {
+            skip();
+            if (source.substr(position, token.size()) != token) {
+                return false;
+            }
+            position += token.size();
+            return true;
+        }
+
+        static bool identifier_start(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        }
+
+        static bool identifier_char(char c) {
+            return identifier_start(c) || (c >= '0' && c <= '9');
+        }
+
+        bool identifier(std::string &name) {
+            skip();
+            if (position == source.size() || !identifier_start(source[position])) {
+                return false;
+            }
+            auto start = position;
+            while (position < source.size() && identifier_char(source[position])) {
+                position++;
+            }
+            name = source.substr(start, position - start);
+            return true;
+        }
+
+        /*!
+         * @return whether a rule definition starts here, which ends the current sequence.
+         */
+        bool definition_ahead() {
+            auto saved_position = position;
+            auto saved_line = line;
+            std::string name;
+            auto result = identifier(name) && (eat("<-") || eat("<~") || eat("<="));
+            position = saved_position;
+            line = saved_line;
+            return result;
+        }
+
+        size_t add(Expression expression) {
+            expression.rule = names.size();
+            expressions.push_back(std::move(expression));
+            return expressions.size() - 1;
+        }
+
+        /*!
+         * Read one byte of a literal or class, resolving escapes.
+         */
+        bool byte(char delimiter, char &c) {
+            if (position == source.size() || source[position] == '\n') {
+                return fail("unterminated literal or class");
+            }
+            c = source[position++];
+            if (c != '\\') {
+                return true;
+            }
+            if (position == source.size()) {
+                return fail("unterminated escape");
+            }
+            auto escaped = source[position++];
+            switch (escaped) {
+                case 'n':
+                    c = '\n';
+                    return true;
+                case 'r':
+                    c = '\r';
+                    return true;
+                case 't':
+                    c = '\t';
+                    return true;
+                case 'v':
+                    c = '\v';
+                    return true;
+                case '\\':
+                    c = '\\';
+                    return true;
+                default:
+                    if (escaped == delimiter || (delimiter == ']' && (escaped == '-' || escaped == '^'))) {
+                        c = escaped;
+                        return true;
+                    }
+                    return fail(std::string("unknown escape \\") + escaped);
+            }
+        }
+
+        std::optional<size_t> literal(char delimiter) {
+            Expression expression{Kind::Literal, line};
+            while (position < source.size() && source[position] != delimiter) {
+                char c;
+                if (!byte(delimiter, c)) {
+                    return std::nullopt;
+                }
+                expression.text.push_back(c);
+            }
+            if (position == source.size()) {
+                fail("unterminated literal");
+                return std::nullopt;
+            }
+            position++;
+            return add(std::move(expression));
+        }
+
+        std::optional<size_t> byte_class() {
+            Expression expression{Kind::Class, line};
+            bool complement = position < source.size() && source[position] == '^';
+            if (complement) {
+                position++;
+            }
+            while (position < source.size() && source[position] != ']') {
+                char begin, end;
+                if (!byte(']', begin)) {
+                    return std::nullopt;
+                }
+                end = begin;
+                if (position + 1 < source.size() && source[position] == '-' && source[position + 1] != ']') {
+                    position++;
+                    if (!byte(']', end)) {
+                        return std::nullopt;
+                    }
+                }
+                auto low = static_cast<unsigned char>(begin), high = static_cast<unsigned char>(end);
+                if (low > high) {
+                    fail("reversed range in class");
+                    return std::nullopt;
+                }
+                expression.set = expression.set | CharSet::range(low, high);
+            }
+            if (position == source.size()) {
+                fail("unterminated class");
+                return std::nullopt;
+            }
+            position++;
+            if (complement) {
+                for (auto &i : expression.set.bits) {
+                    i = ~i;
+                }
+            }
+            return add(std::move(expression));
+        }
+
+        std::optional<size_t> primary() {
+            skip();
+            auto at = line;
+            if (eat("(")) {
+                auto inner = expression();
+                if (inner && !eat(")")) {
+                    fail("expected )");
+                    return std::nullopt;
+                }
+                return inner;
+            } else if (eat(".")) {
+                return add({Kind::Any, at});
+            } else if (eat("^")) {
+                return add({Kind::Start, at});
+            } else if (eat("$")) {
+                return add({Kind::End, at});
+            } else if (eat("'")) {
+                return literal('\'');
+            } else if (eat("\"")) {
+                return literal('"');
+            } else if (eat("[")) {
+                return byte_class();
+            }
+            Expression reference{Kind::Reference, at};
+            if (!identifier(reference.text)) {
+                fail("expected an expression");
+                return std::nullopt;
+            }
+            return add(std::move(reference));
+        }
+
+        std::optional<size_t> suffix() {
+            auto result = primary();
+            while (result) {
+                Kind kind;
+                if (eat("*")) {
+                    kind = Kind::Asterisk;
+                } else if (eat("+")) {
+                    kind = Kind::Plus;
+                } else if (eat("?")) {
+                    kind = Kind::Optional;
+                } else {
+                    break;
+                }
+                result = add({kind, line, {}, {}, {*result}});
+            }
+            return result;
+        }
+
+        std::optional<size_t> prefix() {
+            if (eat("!")) {
+                auto inner = prefix();
+                if (!inner) {
+                    return std::nullopt;
+                }
+                return add({Kind::Not, line, {}, {}, {*inner}});
+            }
+            return suffix();
+        }
+
+        std::optional<size_t> sequence() {
+            Expression expression{Kind::Sequence, line};
+            for (;;) {
+                skip();
+                if (position == source.size() || peek(')') || peek('/') || peek(';') || definition_ahead()) {
+                    break;
+                }
+                auto item = prefix();
+                if (!item) {
+                    return std::nullopt;
+                }
+                expression.children.push_back(*item);
+            }
+            if (expression.children.size() == 1) {
+                return expression.children.front();
+            }
+            if (expression.children.empty()) {
+                // the empty sequence always matches
+                return add({Kind::Literal, expression.line});
+            }
+            return add(std::move(expression));
+        }
+
+        std::optional<size_t> expression() {
+            Expression expression{Kind::Choice, line};
+            do {
+                auto alternative = sequence();
+                if (!alternative) {
+                    return std::nullopt;
+                }
+                expression.children.push_back(*alternative);
+            } while (eat("/"));
+            if (expression.children.size() == 1) {
+                return expression.children.front();
+            }
+            return add(std::move(expression));
+        }
+
+        bool grammar() {
+            skip();
+            while (position < source.size()) {
+                std::string name;
+                if (!identifier(name)) {
+                    return fail("expected a rule name");
+                }
+                bool memo = true, commit = false;
+                if (eat("<~")) {
+                    memo = false;
+                } else if (eat("<=")) {
+                    commit = true;
+                } else if (!eat("<-")) {
+                    return fail("expected <-, <~ or <= after " + name);
+                }
+                if (std::find(names.begin(), names.end(), name) != names.end()) {
+                    return fail("rule " + name + " is defined twice");
+                }
+                if (names.size() == LoadedGrammar::capacity) {
+                    return fail("too many rules");
+                }
+                auto body = expression();
+                if (!body) {
+                    return false;
+                }
+                eat(";");
+                skip();
+                names.push_back(std::move(name));
+                bodies.push_back(*body);
+                memoized.push_back(memo);
+                committed.push_back(commit);
+            }
+            if (names.empty()) {
+                return fail("no rules");
+            }
+            return true;
+        }
+    };
+
+    /*!
+     * Lowering of the expressions to graph nodes, one per pair of expression and rule identity as for templates.
+     */
+    struct Lowering {
+        Reader &reader;
+        RuleGraph &graph;
+        std::map<std::pair<size_t, size_t>, uint32_t> indices{};
+        std::vector<std::pair<size_t, size_t>> pending{};
+        std::map<size_t, uint32_t> commits{};
+        /*!
+         * Expression of every graph node; a commit node has the definition of its rule.
+         */
+        std::vector<size_t> sources{};
+
+        uint32_t reserve(size_t expression) {
+            graph.nodes.emplace_back();
+            sources.push_back(expression);
+            return static_cast<uint32_t>(graph.nodes.size() - 1);
+        }
+
+        std::optional<size_t> rule_index(const Expression &reference) {
+            auto found = std::find(reader.names.begin(), reader.names.end(), reference.text);
+            if (found == reader.names.end()) {
+                reader.line = reference.line;
+                reader.fail("undefined rule " + reference.text);
+                return std::nullopt;
+            }
+            return static_cast<size_t>(found - reader.names.begin());
+        }
+
+        std::optional<uint32_t> rule(size_t index) {
+            if (!reader.committed[index]) {
+                return lower(reader.bodies[index], index);
+            }
+            // a committed rule is a Commit node around its definition, run under the identity of the rule
+            auto found = commits.find(index);
+            if (found != commits.end()) {
+                return found->second;
+            }
+            auto node_index = reserve(reader.bodies[index]);
+            commits.emplace(index, node_index);
+            auto body = lower(reader.bodies[index], index);
+            if (!body) {
+                return std::nullopt;
+            }
+            GraphNode node{};
+            node.op = Operation::Commit;
+            node.id = loaded_id(index);
+            node.memoized = false;
+            node.nullable = false;
+            node.edges = static_cast<uint32_t>(graph.edges.size());
+            node.children = 1;
+            graph.edges.push_back(*body);
+            graph.nodes[node_index] = node;
+            return node_index;
+        }
+
+        /*!
+         * @return the bytes matched by a byte class, a one byte literal, a choice of those or a rule defined as one,
+         * or nullopt for other expressions. Their repetitions are scanned, like byte_class combinators.
+         */
+        std::optional<CharSet> byte_set(size_t index, size_t depth = 0) {
+            auto &expression = reader.expressions[index];
+            switch (expression.kind) {
+                case Kind::Class:
+                    return expression.set;
+                case Kind::Literal:
+                    if (expression.text.size() != 1) {
+                        return std::nullopt;
+                    }
+                    return CharSet::range(static_cast<unsigned char>(expression.text.front()),
+                                          static_cast<unsigned char>(expression.text.front()));
+                case Kind::Choice: {
+                    CharSet set{};
+                    for (auto i : expression.children) {
+                        auto child = byte_set(i, depth);
+                        if (!child) {
+                            return std::nullopt;
+                        }
+                        set = set | *child;
+                    }
+                    return set;
+                }
+                case Kind::Reference: {
+                    auto found = std::find(reader.names.begin(), reader.names.end(), expression.text);
+                    // references may be undefined or cyclic; lowering reports them
+                    if (found == reader.names.end() || depth == reader.names.size()) {
+                        return std::nullopt;
+                    }
+                    return byte_set(reader.bodies[static_cast<size_t>(found - reader.names.begin())], depth + 1);
+                }
+                default:
+                    return std::nullopt;
+            }
+        }
+
+        std::optional<uint32_t> lower(size_t index, size_t identity) {
+            auto key = std::make_pair(index, identity);
+            auto found = indices.find(key);
+            if (found != indices.end()) {
+                return found->second;
+            }
+            auto &expression = reader.expressions[index];
+            if (expression.kind == Kind::Reference) {
+                auto target = rule_index(expression);
+                if (!target) {
+                    return std::nullopt;
+                }
+                if (identity == anonymous) {
+                    return rule(*target);
+                }
+                // a rule defined as another rule runs its definition under its own name
+                if (std::find(pending.begin(), pending.end(), key) != pending.end()) {
+                    reader.line = expression.line;
+                    reader.fail("rule " + reader.names[identity] + " is a cycle of rule names");
+                    return std::nullopt;
+                }
+                pending.push_back(key);
+                auto result = lower(reader.bodies[*target], identity);
+                pending.pop_back();
+                if (result) {
+                    indices.emplace(key, *result);
+                }
+                return result;
+            }
+            auto node_index = reserve(index);
+            indices.emplace(key, node_index);
+            GraphNode node{};
+            node.id = identity == anonymous ? rule_id<LoadedExpression>() : loaded_id(identity);
+            node.memoized = identity != anonymous && reader.memoized[identity];
+            // leaves know their lookahead, composites get it from lookahead()
+            node.nullable = false;
+            std::vector<size_t> children;
+            switch (expression.kind) {
+                case Kind::Literal:
+                    if (expression.text.empty()) {
+                        node.op = Operation::Nothing;
+                        node.nullable = true;
+                    } else if (expression.text.size() == 1) {
+                        node.op = Operation::Char;
+                        node.low = node.high = expression.text.front();
+                        node.first = *byte_set(index);
+                    } else {
+                        node.op = Operation::Literal;
+                        node.edges = static_cast<uint32_t>(graph.literals.size());
+                        node.children = static_cast<uint32_t>(expression.text.size());
+                        graph.literals += expression.text;
+                        node.first = CharSet::range(static_cast<unsigned char>(expression.text.front()),
+                                                    static_cast<unsigned char>(expression.text.front()));
+                    }
+                    break;
+                case Kind::Class:
+                    node.op = Operation::Class;
+                    node.first = expression.set;
+                    break;
+                case Kind::Any:
+                    node.op = Operation::Any;
+                    node.first = CharSet::full();
+                    node.nullable = true;
+                    break;
+                case Kind::Start:
+                    node.op = Operation::Start;
+                    node.nullable = true;
+                    break;
+                case Kind::End:
+                    node.op = Operation::End;
+                    node.nullable = true;
+                    break;
+                case Kind::Sequence:
+                    node.op = Operation::Seq;
+                    children = expression.children;
+                    break;
+                case Kind::Choice:
+                    node.op = Operation::Ord;
+                    children = expression.children;
+                    break;
+                case Kind::Optional:
+                    node.op = Operation::Optional;
+                    children = expression.children;
+                    break;
+                case Kind::Not:
+                    node.op = Operation::Not;
+                    children = expression.children;
+                    break;
+                case Kind::Plus:
+                case Kind::Asterisk: {
+                    auto set = byte_set(expression.children.front());
+                    auto plus = expression.kind == Kind::Plus;
+                    if (set) {
+                        node.op = plus ? Operation::ScanPlus : Operation::ScanAsterisk;
+                        node.first = *set;
+                        node.nullable = !plus;
+                    } else {
+                        node.op = plus ? Operation::Plus : Operation::Asterisk;
+                        children = expression.children;
+                    }
+                    break;
+                }
+                case Kind::Reference:
+                    break;
+            }
+            std::vector<uint32_t> edges;
+            for (auto i : children) {
+                auto child = lower(i, anonymous);
+                if (!child) {
+                    return std::nullopt;
+                }
+                edges.push_back(*child);
+            }
+            if (!edges.empty()) {
+                node.edges = static_cast<uint32_t>(graph.edges.size());
+                node.children = static_cast<uint32_t>(edges.size());
+                graph.edges.insert(graph.edges.end(), edges.begin(), edges.end());
+            }
+            graph.nodes[node_index] = node;
+            return node_index;
+        }
+
+        /*!
+         * Compute the lookahead of the composite nodes as the least fixed point over the graph.
+         */
+        void lookahead() {
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (auto &node : graph.nodes) {
+                    auto child = [&](uint32_t i) -> const GraphNode & {
+                        return graph.nodes[graph.edges[node.edges + i]];
+                    };
+                    bool nullable;
+                    CharSet first{};
+                    switch (node.op) {
+                        case Operation::Seq:
+                            nullable = true;
+                            for (uint32_t i = 0; i < node.children && nullable; ++i) {
+                                first = first | child(i).first;
+                                nullable = child(i).nullable;
+                            }
+                            break;
+                        case Operation::Ord:
+                            nullable = false;
+                            for (uint32_t i = 0; i < node.children; ++i) {
+                                first = first | child(i).first;
+                                nullable |= child(i).nullable;
+                            }
+                            break;
+                        case Operation::Optional:
+                        case Operation::Asterisk:
+                            nullable = true;
+                            first = child(0).first;
+                            break;
+                        case Operation::Plus:
+                        case Operation::Commit:
+                            nullable = child(0).nullable;
+                            first = child(0).first;
+                            break;
+                        case Operation::Not:
+                            nullable = true;
+                            break;
+                        default:
+                            continue;
+                    }
+                    if (nullable != node.nullable || !same(first, node.first)) {
+                        node.nullable = nullable;
+                        node.first = first;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        /*!
+         * Report a problem at the expression of a node, under the name of the node if it is a rule.
+         */
+        bool fail(uint32_t index, const std::string &message) {
+            auto &expression = reader.expressions[sources[index]];
+            auto rule = expression.rule;
+            for (size_t i = 0; i < reader.names.size(); ++i) {
+                if (loaded_id(i) == graph.nodes[index].id) {
+                    rule = i;
+                }
+            }
+            reader.line = expression.line;
+            return reader.fail("rule " + reader.names[rule] + " " + message);
+        }
+
+        /*!
+         * Reject the grammars the engine could never finish: a repetition of an expression that matches without
+         * consuming input, and a rule that calls itself again at the same position (left recursion).
+         * @return whether the graph is safe to run.
+         */
+        bool check() {
+            auto &nodes = graph.nodes;
+            auto child = [&](const GraphNode &node, uint32_t i) { return graph.edges[node.edges + i]; };
+            // whether a node matches without consuming input, as the least fixed point over the graph
+            std::vector<bool> empty(nodes.size());
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (uint32_t i = 0; i < nodes.size(); ++i) {
+                    auto &node = nodes[i];
+                    bool result = false;
+                    switch (node.op) {
+                        case Operation::Start:
+                        case Operation::End:
+                        case Operation::Nothing:
+                        case Operation::ScanAsterisk:
+                        case Operation::Optional:
+                        case Operation::Asterisk:
+                        case Operation::Not:
+                            result = true;
+                            break;
+                        case Operation::Seq:
+                            result = true;
+                            for (uint32_t j = 0; j < node.children && result; ++j) {
+                                result = empty[child(node, j)];
+                            }
+                            break;
+                        case Operation::Ord:
+                            for (uint32_t j = 0; j < node.children && !result; ++j) {
+                                result = empty[child(node, j)];
+                            }
+                            break;
+                        case Operation::Plus:
+                        case Operation::Commit:
+                            result = empty[child(node, 0)];
+                            break;
+                        default:
+                            break;
+                    }
+                    if (result && !empty[i]) {
+                        empty[i] = true;
+                        changed = true;
+                    }
+                }
+            }
+            for (uint32_t i = 0; i < nodes.size(); ++i) {
+                auto op = nodes[i].op;
+                if ((op == Operation::Plus || op == Operation::Asterisk) && empty[child(nodes[i], 0)]) {
+                    return fail(i, "repeats an expression that matches the empty string");
+                }
+            }
+            // depth first search over the calls a node makes at its own position; an edge back to a node on the
+            // path is a cycle of calls that consumes nothing
+            enum : uint8_t { unvisited, open, closed };
+            std::vector<uint8_t> state(nodes.size(), unvisited);
+            std::vector<std::pair<uint32_t, uint32_t>> path;
+            for (uint32_t root = 0; root < nodes.size(); ++root) {
+                if (state[root] != unvisited) {
+                    continue;
+                }
+                state[root] = open;
+                path.emplace_back(root, 0);
+                while (!path.empty()) {
+                    auto &[index, next] = path.back();
+                    auto &node = nodes[index];
+                    // a sequence calls its children at its own position up to the first one that consumes input
+                    bool more = next < node.children &&
+                                (node.op != Operation::Seq || !next || empty[child(node, next - 1)]);
+                    if (!more) {
+                        state[index] = closed;
+                        path.pop_back();
+                        continue;
+                    }
+                    auto target = child(node, next++);
+                    if (state[target] == open) {
+                        // report a rule of the cycle rather than one of its anonymous expressions
+                        auto named = target;
+                        for (auto i = path.size(); i-- > 0 && path[i].first != target;) {
+                            if (nodes[path[i].first].id != rule_id<LoadedExpression>()) {
+                                named = path[i].first;
+                            }
+                        }
+                        return fail(named, "is left recursive");
+                    }
+                    if (state[target] == unvisited) {
+                        state[target] = open;
+                        path.emplace_back(target, 0);
+                    }
+                }
+            }
+            return true;
+        }
+    };
+}
+
+std::optional<size_t> parser::LoadedGrammar::rule(std::string_view name) const {
+    auto found = std::find(names.begin(), names.end(), name);
+    if (found == names.end()) {
+        return std::nullopt;
+    }
+    return loaded_id(static_cast<size_t>(found - names.begin()));
+}
+
+std::string_view parser::LoadedGrammar::name(size_t rule) const {
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (rule == loaded_id(i)) {
+            return names[i];
+        }
+    }
+    return {};
+}
+
+bool parser::LoadedGrammar::start(std::string_view name) {
+    auto found = std::find(names.begin(), names.end(), name);
+    if (found == names.end()) {
+        return false;
+    }
+    graph.root = rules[static_cast<size_t>(found - names.begin())];
+    return true;
+}
+
+std::optional<parser::LoadedGrammar> parser::load_grammar(std::string_view source, std::string &error) {
+    Reader reader{source};
+    if (!reader.grammar()) {
+        error = reader.error;
+        return std::nullopt;
+    }
+    LoadedGrammar grammar;
+    Lowering lowering{reader, grammar.graph};
+    for (size_t i = 0; i < reader.names.size(); ++i) {
+        auto node = lowering.rule(i);
+        if (!node) {
+            error = reader.error;
+            return std::nullopt;
+        }
+        grammar.rules.push_back(*node);
+    }
+    lowering.lookahead();
+    if (!lowering.check()) {
+        error = reader.error;
+        return std::nullopt;
+    }
+    grammar.names = std::move(reader.names);
+    grammar.graph.root = grammar.rules.front();
+    return grammar;
+}
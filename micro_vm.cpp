@@ -0,0 +1,316 @@
+//
+// Created by schrodinger on 2/17/21.
+//
+
+#include "micro_vm.h"
+#include "sym_table.h"
+
+namespace {
+    using parser::TreePtr;
+
+    /*!
+     * Register kinds used during compilation, in the two high bits of a register number. They are relocated
+     * into one register file once all variables and constants are known.
+     */
+    constexpr uint32_t variable_kind = 0u << 30u;
+    constexpr uint32_t constant_kind = 1u << 30u;
+    constexpr uint32_t temporary_kind = 2u << 30u;
+    constexpr uint32_t kind_mask = 3u << 30u;
+
+    template<class T>
+    bool is(TreePtr tree) {
+        return tree->rule == parser::rule_id<T>();
+    }
+
+    int64_t literal(std::string_view digits) {
+        uint64_t value = 0;
+        for (auto c : digits) {
+            value = value * 10 + static_cast<uint64_t>(c - '0');
+        }
+        return static_cast<int64_t>(value);
+    }
+
+    int64_t apply(std::string_view op, int64_t left, int64_t right) {
+        auto l = static_cast<uint64_t>(left), r = static_cast<uint64_t>(right);
+        return static_cast<int64_t>(op == "+" ? l + r : l - r);
+    }
+
+    struct Compiler {
+        micro::Program program{};
+        symtable::SymTable<uint32_t> symbols{};
+        std::unordered_map<int64_t, uint32_t> constants{};
+        uint32_t temporaries = 0;
+        uint32_t used = 0;
+        bool valid = true;
+
+        uint32_t variable(std::string_view name) {
+            if (auto slot = symbols.find(name)) {
+                return *slot;
+            }
+            auto slot = static_cast<uint32_t>(program.variables.size()) | variable_kind;
+            symbols.define(name, slot);
+            program.variables.emplace_back(name);
+            return slot;
+        }
+
+        uint32_t constant(std::string_view digits) {
+            auto value = literal(digits);
+            auto slot = constants.emplace(value, static_cast<uint32_t>(program.constants.size()) | constant_kind);
+            if (slot.second) {
+                program.constants.push_back(value);
+            }
+            return slot.first->second;
+        }
+
+        uint32_t temporary() {
+            used = std::max(used, temporaries + 1);
+            return temporaries++ | temporary_kind;
+        }
+
+        void release(uint32_t reg) {
+            // temporaries are allocated and released as a stack
+            if ((reg & kind_mask) == temporary_kind) {
+                temporaries--;
+            }
+        }
+
+        void emit(micro::Opcode op, uint32_t target, uint32_t left = 0, uint32_t right = 0) {
+            program.code.push_back({op, target, left, right});
+        }
+
+        uint32_t primary(TreePtr tree) {
+            if (tree->subtrees().size() != 1) {
+                valid = false;
+                return 0;
+            }
+            auto inner = tree->subtrees()[0];
+            if (is<grammar::Expr>(inner)) {
+                return expression(inner);
+            } else if (is<grammar::Identity>(inner)) {
+                return variable(inner->parsed_region);
+            } else if (is<grammar::Integer>(inner)) {
+                return constant(inner->parsed_region);
+            }
+            valid = false;
+            return 0;
+        }
+
+        uint32_t expression(TreePtr tree) {
+            auto terms = tree->subtrees();
+            if (terms.size() % 2 == 0) {
+                valid = false;
+                return 0;
+            }
+            auto left = primary(terms[0]);
+            for (size_t i = 1; i < terms.size(); i += 2) {
+                if (!is<grammar::Op>(terms[i])) {
+                    valid = false;
+                    return 0;
+                }
+                auto right = primary(terms[i + 1]);
+                release(right);
+                release(left);
+                auto target = temporary();
+                emit(terms[i]->parsed_region == "+" ? micro::Opcode::Add : micro::Opcode::Sub, target, left, right);
+                left = target;
+            }
+            return left;
+        }
+
+        void assignment(TreePtr tree) {
+            if (tree->subtrees().size() != 2 || !is<grammar::Identity>(tree->subtrees()[0]) ||
+                !is<grammar::Expr>(tree->subtrees()[1])) {
+                valid = false;
+                return;
+            }
+            auto target = variable(tree->subtrees()[0]->parsed_region);
+            auto value = expression(tree->subtrees()[1]);
+            if ((value & kind_mask) == temporary_kind && program.code.back().target == value) {
+                // store the last operation straight into the variable
+                program.code.back().target = target;
+            } else {
+                emit(micro::Opcode::Move, target, value);
+            }
+            release(value);
+        }
+
+        void statement(TreePtr tree) {
+            if (is<grammar::Assignment>(tree)) {
+                assignment(tree);
+            } else if (is<grammar::ReadStmt>(tree)) {
+                for (auto i : tree->subtrees()) {
+                    valid &= is<grammar::Identity>(i);
+                    emit(micro::Opcode::Read, variable(i->parsed_region));
+                }
+            } else if (is<grammar::WriteStmt>(tree)) {
+                for (auto i : tree->subtrees()) {
+                    if (!is<grammar::Expr>(i)) {
+                        valid = false;
+                        return;
+                    }
+                    auto value = expression(i);
+                    emit(micro::Opcode::Write, 0, value);
+                    release(value);
+                }
+            } else {
+                valid = false;
+            }
+        }
+
+        void relocate() {
+            auto variables = static_cast<uint32_t>(program.variables.size());
+            auto base = variables + static_cast<uint32_t>(program.constants.size());
+            auto place = [&](uint32_t &reg) {
+                auto index = reg & ~kind_mask;
+                switch (reg & kind_mask) {
+                    case constant_kind:
+                        reg = variables + index;
+                        break;
+                    case temporary_kind:
+                        reg = base + index;
+                        break;
+                    default:
+                        reg = index;
+                }
+            };
+            for (auto &i : program.code) {
+                place(i.target);
+                place(i.left);
+                place(i.right);
+            }
+            program.registers = base + used;
+        }
+    };
+
+    struct Evaluator {
+        symtable::SymTable<int64_t> table{};
+        const std::vector<int64_t> &input;
+        std::vector<int64_t> &output;
+        size_t next = 0;
+        bool valid = true;
+
+        void assign(std::string_view name, int64_t value) {
+            if (!table.update(name, true, value)) {
+                table.define(name, value);
+            }
+        }
+
+        int64_t primary(TreePtr tree) {
+            if (tree->subtrees().size() != 1) {
+                valid = false;
+                return 0;
+            }
+            auto inner = tree->subtrees()[0];
+            if (is<grammar::Expr>(inner)) {
+                return expression(inner);
+            } else if (is<grammar::Identity>(inner)) {
+                auto value = table.find(inner->parsed_region);
+                return value ? *value : 0;
+            } else if (is<grammar::Integer>(inner)) {
+                return literal(inner->parsed_region);
+            }
+            valid = false;
+            return 0;
+        }
+
+        int64_t expression(TreePtr tree) {
+            auto terms = tree->subtrees();
+            if (terms.size() % 2 == 0) {
+                valid = false;
+                return 0;
+            }
+            auto value = primary(terms[0]);
+            for (size_t i = 1; i < terms.size(); i += 2) {
+                value = apply(terms[i]->parsed_region, value, primary(terms[i + 1]));
+            }
+            return value;
+        }
+
+        void statement(TreePtr tree) {
+            if (is<grammar::Assignment>(tree) && tree->subtrees().size() == 2) {
+                assign(tree->subtrees()[0]->parsed_region, expression(tree->subtrees()[1]));
+            } else if (is<grammar::ReadStmt>(tree)) {
+                for (auto i : tree->subtrees()) {
+                    if (next == input.size()) {
+                        valid = false;
+                        return;
+                    }
+                    assign(i->parsed_region, input[next++]);
+                }
+            } else if (is<grammar::WriteStmt>(tree)) {
+                for (auto i : tree->subtrees()) {
+                    output.push_back(expression(i));
+                }
+            } else {
+                valid = false;
+            }
+        }
+    };
+}
+
+std::optional<micro::Program> micro::compile(parser::TreePtr toplevel) {
+    if (!toplevel || !is<grammar::Toplevel>(toplevel)) {
+        return std::nullopt;
+    }
+    Compiler compiler;
+    for (auto i : toplevel->subtrees()) {
+        compiler.statement(i);
+        if (!compiler.valid) {
+            return std::nullopt;
+        }
+    }
+    compiler.emit(Opcode::Halt, 0);
+    compiler.relocate();
+    return std::move(compiler.program);
+}
+
+bool micro::execute(const Program &program, const std::vector<int64_t> &input, std::vector<int64_t> &output) {
+    std::vector<int64_t> file(program.registers);
+    std::copy(program.constants.begin(), program.constants.end(), file.begin() + program.variables.size());
+    auto registers = file.data();
+    auto pc = program.code.data();
+    size_t next = 0;
+    for (;;) {
+        auto &instruction = *pc++;
+        switch (instruction.op) {
+            case Opcode::Move:
+                registers[instruction.target] = registers[instruction.left];
+                break;
+            case Opcode::Add:
+                registers[instruction.target] = static_cast<int64_t>(
+                        static_cast<uint64_t>(registers[instruction.left]) +
+                        static_cast<uint64_t>(registers[instruction.right]));
+                break;
+            case Opcode::Sub:
+                registers[instruction.target] = static_cast<int64_t>(
+                        static_cast<uint64_t>(registers[instruction.left]) -
+                        static_cast<uint64_t>(registers[instruction.right]));
+                break;
+            case Opcode::Read:
+                if (next == input.size()) {
+                    return false;
+                }
+                registers[instruction.target] = input[next++];
+                break;
+            case Opcode::Write:
+                output.push_back(registers[instruction.left]);
+                break;
+            case Opcode::Halt:
+                return true;
+        }
+    }
+}
+
+bool micro::evaluate(parser::TreePtr toplevel, const std::vector<int64_t> &input, std::vector<int64_t> &output) {
+    if (!toplevel || !is<grammar::Toplevel>(toplevel)) {
+        return false;
+    }
+    Evaluator evaluator{{}, input, output};
+    for (auto i : toplevel->subtrees()) {
+        evaluator.statement(i);
+        if (!evaluator.valid) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+//
+// Created by schrodinger on 2/9/21.
+//
+
+#include "grammar/parallel.h"
+
+std::vector<size_t> parser::unit_boundaries(std::string_view text, const CharSet &first, char terminator) {
+    std::vector<size_t> result;
+    size_t depth = 0;
+    for (size_t position = 0; position < text.size(); ++position) {
+        auto c = text[position];
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth -= depth != 0;
+        } else if (c == terminator && depth == 0) {
+            auto start = position + 1;
+            while (start < text.size() && !first.contains(static_cast<unsigned char>(text[start]))) {
+                start++;
+            }
+            if (start < text.size() && (result.empty() || result.back() < start)) {
+                result.push_back(start);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,27 @@
+//
+// Created by schrodinger on 2/12/21.
+//
+
+#include "grammar/recognize.h"
+
+void parser::LengthTable::insert(const MemoKey &key, size_t length) {
+    if (key.first < base || (length != no_match && length >= UINT32_MAX - 2)) {
+        return;
+    }
+    if (key.second >= columns.size()) {
+        columns.resize(key.second + 1);
+    }
+    auto &column = columns[key.second];
+    auto index = key.first - base;
+    if (index >= column.size()) {
+        column.resize(index + 1);
+    }
+    column[index] = length == no_match ? 1 : static_cast<uint32_t>(length + 2);
+}
+
+void parser::LengthTable::retire(size_t position) {
+    for (auto &column : columns) {
+        column.clear();
+    }
+    base = std::max(base, position);
+}
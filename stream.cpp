@@ -0,0 +1,73 @@
+//
+// Created by schrodinger on 2/5/21.
+//
+
+#include "grammar/stream.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+parser::MappedFile::MappedFile(MappedFile &&that) noexcept
+        : data(that.data), size(that.size), released(that.released) {
+    that.data = nullptr;
+    that.size = 0;
+    that.released = 0;
+}
+
+parser::MappedFile &parser::MappedFile::operator=(MappedFile &&that) noexcept {
+    if (this != &that) {
+        close();
+        std::swap(data, that.data);
+        std::swap(size, that.size);
+        std::swap(released, that.released);
+    }
+    return *this;
+}
+
+parser::MappedFile::~MappedFile() {
+    close();
+}
+
+bool parser::MappedFile::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (info.st_size > 0) {
+        auto address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        madvise(address, info.st_size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(address);
+        size = info.st_size;
+    }
+    ::close(fd);
+    return true;
+}
+
+void parser::MappedFile::close() {
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+    released = 0;
+}
+
+void parser::MappedFile::release(size_t position) {
+    auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    auto end = std::min(position, size) / page * page;
+    if (end > released) {
+        madvise(const_cast<char *>(data) + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+}
@@ -0,0 +1,64 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/grammar.h"
+#include "grammar/grammar.ipp"
+#include "grammar/iterative.h"
+#include "grammar/recognize.h"
+#include "grammar/select.h"
+#include <iostream>
+
+namespace bytes {
+    using namespace parser;
+
+    RULE(Pair, Seq<Any, Any>)
+
+    RULE(Quoted, Seq<Char<'"'>, Asterisk<Seq<Not<Char<'"'>>, Any>>, Char<'"'>>)
+
+    RULE(Rest, Seq<Asterisk<Any>, Not<Any>>)
+}
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    size_t length(parser::TreePtr tree) {
+        return tree ? tree->parsed_region.size() : parser::no_match;
+    }
+
+    /*!
+     * Match a rule from the start of a text with every engine and compare the lengths with the expected one.
+     */
+    template<class Rule>
+    void check(std::string_view text, size_t expected, const std::string &what) {
+        auto session = std::make_shared<parser::ParseSession>();
+        expect(length(Rule().match(parser::PContext{session, text, 0, 0})) == expected, what + ": virtual");
+        parser::ParseSession static_session;
+        expect(length(parser::parse_static<Rule>(static_session, text)) == expected, what + ": static");
+        parser::ParseSession iterative_session;
+        expect(length(parser::parse_iterative<Rule>(iterative_session, text)) == expected, what + ": iterative");
+        expect(parser::recognize<Rule>(text) == expected, what + ": recognize");
+    }
+}
+
+int main() {
+    using parser::no_match;
+    // Any matches one byte wherever one remains, and fails at the end of the input
+    check<bytes::Pair>("ab", 2, "pair");
+    check<bytes::Pair>("abc", 2, "pair of three");
+    check<bytes::Pair>("a", no_match, "pair of one");
+    check<bytes::Pair>("", no_match, "pair of none");
+    check<bytes::Quoted>("\"x;y\" tail", 5, "quoted");
+    check<bytes::Quoted>("\"\"", 2, "empty quoted");
+    check<bytes::Quoted>("\"abc", no_match, "unterminated");
+    check<bytes::Rest>("hello", 5, "rest");
+    check<bytes::Rest>("", 0, "empty rest");
+    return failures != 0;
+}
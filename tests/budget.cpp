@@ -0,0 +1,75 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/iterative.h"
+#include "grammar/select.h"
+#include "../bench/generator.h"
+#include <iostream>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    parser::ParseBudget invocations(size_t count) {
+        parser::ParseBudget budget;
+        budget.invocations = count;
+        budget.interval = 1;
+        return budget;
+    }
+
+    /*!
+     * Stop a parse early on a session, then parse the same text on it again without a budget: the second parse
+     * must not reuse failures the first one recorded for refused invocations.
+     */
+    template<class Parse>
+    void stop_and_resume(const std::string &name, std::string_view text, Parse parse) {
+        for (size_t count : {1, 5, 100, 2000}) {
+            auto what = name + " after " + std::to_string(count) + " invocations";
+            auto session = std::make_shared<parser::ParseSession>();
+            session->limit(invocations(count));
+            expect(parse(session, text) == nullptr, what + ": stopped");
+            auto progress = session->report();
+            expect(progress.exhausted == parser::Exhausted::Invocations && progress.invocations == count,
+                   what + ": progress");
+            session->limit({});
+            auto tree = parse(session, text);
+            expect(tree != nullptr && tree->parsed_region.size() == text.size(), what + ": resumed");
+            expect(session->report().exhausted == parser::Exhausted::None, what + ": resumed progress");
+        }
+    }
+}
+
+int main() {
+    bench::GeneratorOptions options;
+    options.statements = 50;
+    auto text = bench::Generator(options).program();
+    using Session = std::shared_ptr<parser::ParseSession>;
+    stop_and_resume("virtual", text, [](const Session &session, std::string_view text) {
+        return grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+    });
+    stop_and_resume("iterative", text, [](const Session &session, std::string_view text) {
+        return parser::parse_iterative<grammar::Toplevel>(*session, text);
+    });
+    stop_and_resume("static", text, [](const Session &session, std::string_view text) {
+        return parser::parse_static<grammar::Toplevel>(*session, text);
+    });
+    stop_and_resume("selected", text, [](const Session &session, std::string_view text) {
+        return parser::parse_selected<grammar::Toplevel, grammar::SelectRule>(*session, text);
+    });
+
+    // parse_budgeted drops what the stopped parse left behind
+    auto session = std::make_shared<parser::ParseSession>();
+    parser::ParseProgress progress;
+    expect(!parser::parse_budgeted<grammar::Toplevel>(session, text, invocations(5), progress),
+           "budgeted: stopped");
+    expect(parser::parse_budgeted<grammar::Toplevel>(session, text, {}, progress) != nullptr, "budgeted: resumed");
+    return failures != 0;
+}
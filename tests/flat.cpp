@@ -0,0 +1,91 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/flat.h"
+#include "grammar/iterative.h"
+#include "../bench/generator.h"
+#include <iostream>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    size_t count_nodes(parser::TreePtr tree) {
+        size_t result = 0;
+        std::vector<parser::TreePtr> pending{tree};
+        while (!pending.empty()) {
+            auto node = pending.back();
+            pending.pop_back();
+            result++;
+            pending.insert(pending.end(), node->subtrees().begin(), node->subtrees().end());
+        }
+        return result;
+    }
+
+    /*!
+     * Flatten a tree, read it back, and compare the node count and the region of the root and of its children.
+     */
+    void round_trip(parser::TreePtr tree, std::string_view text, const std::string &what) {
+        auto bytes = parser::flatten(tree, text, what);
+        parser::FlatTree flat;
+        expect(flat.load(bytes), what + ": load");
+        expect(flat.size() == count_nodes(tree), what + ": node count");
+        expect(flat.matches(text) && flat.source_name() == what, what + ": source");
+        auto root = flat.root();
+        expect(root.region(text) == tree->parsed_region && root.node().descendants == flat.size() - 1,
+               what + ": root");
+        size_t index = 0;
+        for (auto child : root.subtrees()) {
+            expect(index < tree->subtrees().size() && child.region(text) == tree->subtrees()[index]->parsed_region,
+                   what + ": child " + std::to_string(index));
+            index++;
+        }
+        expect(index == tree->subtrees().size(), what + ": children");
+    }
+}
+
+int main() {
+    bench::GeneratorOptions options;
+    options.statements = 500;
+    auto text = bench::Generator(options).program();
+    auto session = std::make_shared<parser::ParseSession>();
+    auto tree = grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+    expect(tree != nullptr, "program: match");
+    if (tree) {
+        round_trip(tree, text, "program");
+    }
+
+    // a nesting far deeper than the native stack could walk
+    const size_t nesting = 1000000;
+    auto nested = "begin x := " + std::string(nesting, '(') + "1" + std::string(nesting, ')') + "; end";
+    parser::ParseSession nested_session;
+    auto deep = parser::parse_iterative<grammar::Toplevel>(nested_session, nested);
+    expect(deep != nullptr, "nested: match");
+    if (deep) {
+        round_trip(deep, nested, "nested");
+        auto bytes = parser::flatten(deep, nested, "nested");
+        parser::FlatTree flat;
+        flat.load(bytes);
+        // follow the largest child down to the innermost literal
+        size_t depth = 0;
+        for (auto cursor = flat.root(); cursor.valid(); depth++) {
+            auto next = parser::FlatCursor{};
+            for (auto child : cursor.subtrees()) {
+                if (!next.valid() || child.node().descendants > next.node().descendants) {
+                    next = child;
+                }
+            }
+            cursor = next;
+        }
+        expect(depth > nesting, "nested: depth");
+    }
+    return failures != 0;
+}
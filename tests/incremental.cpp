@@ -0,0 +1,114 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/incremental.h"
+#include "grammar/flat.h"
+#include "../bench/generator.h"
+#include <iostream>
+#include <random>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    struct Edit {
+        size_t offset;
+        size_t removed;
+        std::string inserted;
+    };
+
+    /*!
+     * Random edits of a program: whitespace and digits that keep it valid, deletions and junk that usually do
+     * not, and edits at the start and at the end of the text.
+     */
+    Edit random_edit(std::mt19937_64 &random, const std::string &text) {
+        auto at = [&](size_t bound) { return static_cast<size_t>(random() % (bound + 1)); };
+        switch (random() % 8) {
+            case 0:
+                return {0, 0, random() % 2 ? " " : "\n\t"};
+            case 1:
+                return {0, at(2), ""};
+            case 2:
+                return {text.size(), 0, random() % 2 ? "\n" : "x"};
+            case 3:
+                return {at(text.size()), at(3), ""};
+            case 4:
+                return {at(text.size()), 0, std::string(1, "+-;:=()x7 "[random() % 10])};
+            case 5: {
+                auto offset = at(text.size());
+                return {offset, text.size() > offset && text[offset] == ' ' ? 1u : 0u, "  "};
+            }
+            case 6: {
+                auto offset = at(text.size());
+                auto digit = text.find_first_of("0123456789", offset);
+                if (digit == std::string::npos) {
+                    return {offset, 0, " "};
+                }
+                return {digit, 1, std::string(1, static_cast<char>('0' + random() % 10))};
+            }
+            default: {
+                auto offset = at(text.size());
+                return {offset, at(8), "a := 1;\n"};
+            }
+        }
+    }
+
+    /*!
+     * Apply random edits to an incremental parser and to a copy of its text, and compare every incremental parse
+     * with a fresh parse of the copy, down to the offsets of the serialized trees.
+     */
+    void differential(uint64_t seed, size_t edits, size_t compact_limit) {
+        bench::GeneratorOptions options;
+        options.statements = 200;
+        options.seed = seed;
+        auto text = bench::Generator(options).program();
+        std::mt19937_64 random{seed};
+        parser::IncrementalParser<grammar::Toplevel> incremental{text, compact_limit};
+        incremental.parse();
+        size_t matched = 0;
+        for (size_t i = 0; i < edits; ++i) {
+            // several edits between parses now and then
+            size_t batch = random() % 4 ? 1 : 3;
+            for (size_t j = 0; j < batch; ++j) {
+                auto edit = random_edit(random, text);
+                incremental.apply_edit(edit.offset, edit.removed, edit.inserted);
+                auto offset = std::min(edit.offset, text.size());
+                text.replace(offset, std::min(edit.removed, text.size() - offset), edit.inserted);
+            }
+            auto tree = incremental.parse();
+            auto what = "seed " + std::to_string(seed) + " edit " + std::to_string(i);
+            expect(incremental.text() == text, what + ": text");
+            auto session = std::make_shared<parser::ParseSession>();
+            auto fresh = grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+            expect((tree == nullptr) == (fresh == nullptr), what + ": match");
+            if (tree && fresh) {
+                matched++;
+                expect(parser::flatten(tree, incremental.text(), "t") == parser::flatten(fresh, text, "t"),
+                       what + ": tree");
+            }
+            if (!fresh) {
+                // start over from a valid program
+                incremental.apply_edit(0, text.size(), bench::Generator(options).program());
+                text = bench::Generator(options).program();
+            }
+        }
+        expect(matched > edits / 4, "seed " + std::to_string(seed) + ": too few valid programs");
+    }
+}
+
+int main() {
+    for (uint64_t seed = 1; seed <= 4; ++seed) {
+        differential(seed, 150, 64);
+    }
+    // compaction in the middle of the edits
+    differential(5, 150, 4);
+    return failures != 0;
+}
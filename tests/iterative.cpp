@@ -0,0 +1,91 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/iterative.h"
+#include "grammar/flat.h"
+#include "../bench/generator.h"
+#include <iostream>
+#include <random>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /*!
+     * Parse a text with the iterative engine and with the virtual match, and compare the trees, the memo entries
+     * left in the sessions, and the trees handed to the commit callback of a streaming parse.
+     */
+    void compare(std::string_view text, const std::string &what) {
+        auto virtual_session = std::make_shared<parser::ParseSession>();
+        auto expected = grammar::Toplevel().match(parser::PContext{virtual_session, text, 0, 0});
+        parser::ParseSession session;
+        auto tree = parser::parse_iterative<grammar::Toplevel>(session, text);
+        expect((tree == nullptr) == (expected == nullptr), what + ": match");
+        if (tree && expected) {
+            expect(parser::flatten(tree, text, "t") == parser::flatten(expected, text, "t"), what + ": tree");
+        }
+        expect(session.table.size() == virtual_session->table.size(), what + ": memo entries");
+
+        std::vector<std::string> expected_commits, commits;
+        auto streaming = std::make_shared<parser::ParseSession>();
+        streaming->on_commit = [&](parser::TreePtr committed) {
+            expected_commits.push_back(parser::flatten(committed, text, "t"));
+        };
+        auto streamed = grammar::Toplevel().match(parser::PContext{streaming, text, 0, 0}) != nullptr;
+        parser::ParseSession iterative_streaming;
+        iterative_streaming.on_commit = [&](parser::TreePtr committed) {
+            commits.push_back(parser::flatten(committed, text, "t"));
+        };
+        expect(streamed == (parser::parse_iterative<grammar::Toplevel>(iterative_streaming, text) != nullptr),
+               what + ": streaming match");
+        expect(commits.size() == expected_commits.size(), what + ": commit count");
+        expect(commits == expected_commits, what + ": committed trees");
+    }
+}
+
+int main() {
+    std::mt19937_64 random{1};
+    for (uint64_t seed = 1; seed <= 4; ++seed) {
+        bench::GeneratorOptions options;
+        options.statements = 300;
+        options.depth = 2 + seed;
+        options.seed = seed;
+        auto text = bench::Generator(options).program();
+        auto name = "seed " + std::to_string(seed);
+        compare(text, name);
+        // broken programs fail in the same place with the same memo table
+        for (size_t mutation = 0; mutation < 6; ++mutation) {
+            auto mutated = text;
+            auto position = random() % mutated.size();
+            if (random() % 2) {
+                mutated.erase(position, 1 + random() % 4);
+            } else {
+                mutated.insert(position, 1, "();:=+x7 "[random() % 9]);
+            }
+            compare(mutated, name + " mutation " + std::to_string(mutation));
+        }
+    }
+    compare("begin end", "empty body");
+    compare("", "empty input");
+
+    // a nesting the native stack could not hold
+    const size_t nesting = 1000000;
+    auto nested = "begin x := " + std::string(nesting, '(') + "1" + std::string(nesting, ')') + "; end";
+    parser::ParseSession session;
+    auto tree = parser::parse_iterative<grammar::Toplevel>(session, nested);
+    expect(tree != nullptr && tree->parsed_region.size() == nested.size(), "nested: match");
+    auto unbalanced = nested;
+    unbalanced.erase(unbalanced.size() - 8, 1);
+    parser::ParseSession unbalanced_session;
+    expect(parser::parse_iterative<grammar::Toplevel>(unbalanced_session, unbalanced) == nullptr,
+           "nested: unbalanced");
+    return failures != 0;
+}
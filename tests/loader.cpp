@@ -0,0 +1,54 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "grammar/loader.h"
+#include <iostream>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, std::string_view what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    void rejects(std::string_view source, std::string_view message) {
+        std::string error;
+        auto grammar = parser::load_grammar(source, error);
+        expect(!grammar, source);
+        expect(error.find(message) != std::string::npos, error);
+    }
+
+    void accepts(std::string_view source, std::string_view text) {
+        std::string error;
+        auto grammar = parser::load_grammar(source, error);
+        expect(grammar.has_value(), error);
+        if (grammar) {
+            parser::ParseSession session;
+            auto tree = parser::parse_loaded(*grammar, session, text);
+            expect(tree && tree->parsed_region.size() == text.size(), text);
+        }
+    }
+}
+
+int main() {
+    // left recursion, direct, indirect and behind nullable prefixes
+    rejects("A <- A 'x' / 'y'", "line 1: rule A is left recursive");
+    rejects("A <- 'z'\nB <- C 'x' / 'y'\nC <- B", "rule C is left recursive");
+    rejects("A <- 'a'? !'b' A 'x' / 'y'", "rule A is left recursive");
+    rejects("A <- 'q' / B\nB <= (A / 'x') 'y'", "left recursive");
+    // repetitions of expressions that match the empty string
+    rejects("A <- 'x'\n\nB <- ('a'?)*", "line 3: rule B repeats an expression that matches the empty string");
+    rejects("A <- (!'a')*", "rule A repeats");
+    rejects("A <- ('a' / '')+", "rule A repeats");
+    rejects("A <- B*\nB <- 'b'* 'c'?", "rule A repeats");
+    // recursion that consumes input first, and repetitions that always consume
+    accepts("A <- 'x' A / 'y'", "xxxy");
+    accepts("A <- B*\nB <- 'a' 'b'? / C\nC <- '(' A ')'", "ab(a(ab))a");
+    accepts("A <- .*", "anything");
+    accepts("A <- ('a' ![b])+", "aaa");
+    return failures != 0;
+}
@@ -0,0 +1,118 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/parallel.h"
+#include "grammar/flat.h"
+#include "../bench/generator.h"
+#include <iostream>
+#include <random>
+
+namespace listing {
+    using namespace parser;
+
+    POLICY_RULE(Letter, Transient, CharRange<'a', 'z'>)
+
+    RULE(Name, Plus<Letter>)
+
+    POLICY_RULE(Quote, Transient, Char<'"'>)
+
+    POLICY_RULE(Inside, Transient, Ord<CharRange<' ', '!'>, CharRange<'#', '~'>>)
+
+    RULE(Text, Seq<Quote, Asterisk<Inside>, Quote>)
+
+    RULE(Entry, SpaceInterleaved<Name, Char<'='>, Text, Char<';'>>)
+
+    RULE(Listing, SpaceInterleaved<Start, Plus<Entry>, End>)
+}
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    /*!
+     * Parse a text on pools of several sizes and compare every tree with a sequential parse.
+     * @return whether the text matches.
+     */
+    template<class Rule, class Unit>
+    bool compare(const std::vector<std::unique_ptr<parser::ParsePool>> &pools, const std::string &text,
+                 const std::string &what) {
+        auto sequential = std::make_shared<parser::ParseSession>();
+        auto expected = Rule().match(parser::PContext{sequential, text, 0, 0});
+        for (auto &pool : pools) {
+            auto where = what + " on " + std::to_string(pool->size()) + " workers";
+            auto session = std::make_shared<parser::ParseSession>();
+            auto tree = parser::parse_parallel<Rule, Unit>(*pool, session, text);
+            expect((tree == nullptr) == (expected == nullptr), where + ": match");
+            if (tree && expected) {
+                expect(parser::flatten(tree, text, "t") == parser::flatten(expected, text, "t"), where + ": tree");
+            }
+        }
+        return expected != nullptr;
+    }
+
+    /*!
+     * A listing whose texts hold terminators, parentheses and names, so that most candidate boundaries fall inside
+     * a text and the units parsed from them are never used.
+     */
+    std::string listing_text(std::mt19937_64 &random, size_t entries) {
+        static const char *const fragments[] = {"; x", "; y = ", ";", "(", ")", "; z;", "a", " ", ";; q"};
+        std::string result;
+        for (size_t i = 0; i < entries; ++i) {
+            result += std::string(1 + random() % 3, static_cast<char>('a' + random() % 26));
+            result += " = \"";
+            for (auto count = random() % 6; count-- > 0;) {
+                result += fragments[random() % std::size(fragments)];
+            }
+            result += "\";\n";
+        }
+        return result;
+    }
+}
+
+int main() {
+    std::vector<std::unique_ptr<parser::ParsePool>> pools;
+    for (size_t workers : {2, 3, 4}) {
+        pools.push_back(std::make_unique<parser::ParsePool>(workers));
+    }
+    std::mt19937_64 random{1};
+    for (uint64_t seed = 1; seed <= 3; ++seed) {
+        bench::GeneratorOptions options;
+        options.statements = 3000;
+        options.seed = seed;
+        auto text = bench::Generator(options).program();
+        auto name = "seed " + std::to_string(seed);
+        expect(compare<grammar::Toplevel, grammar::Stmt>(pools, text, name), name + ": valid");
+
+        // stray bytes that move the candidate boundaries and usually break the program
+        for (size_t mutation = 0; mutation < 8; ++mutation) {
+            auto mutated = text;
+            for (auto count = 1 + random() % 3; count-- > 0;) {
+                mutated.insert(random() % mutated.size(), 1, ";()"[random() % 3]);
+            }
+            compare<grammar::Toplevel, grammar::Stmt>(pools, mutated, name + " mutation " + std::to_string(mutation));
+        }
+        // removing a statement terminator merges two candidate chunks' units
+        auto merged = text;
+        merged.erase(merged.find(';', merged.size() / 2), 1);
+        compare<grammar::Toplevel, grammar::Stmt>(pools, merged, name + " merged");
+    }
+
+    // false boundaries inside texts
+    for (size_t round = 0; round < 4; ++round) {
+        auto text = listing_text(random, 4000);
+        expect(compare<listing::Listing, listing::Entry>(pools, text, "listing " + std::to_string(round)),
+               "listing " + std::to_string(round) + ": valid");
+        auto broken = text;
+        broken.insert(broken.find('"', broken.size() / 3), 1, '"');
+        compare<listing::Listing, listing::Entry>(pools, broken, "broken listing " + std::to_string(round));
+    }
+    return failures != 0;
+}
@@ -0,0 +1,100 @@
+//
+// Created by schrodinger on 2/19/21.
+//
+
+#include "micro.h"
+#include "grammar/stream.h"
+#include "../bench/generator.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+    int failures = 0;
+
+    void expect(bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    using Region = std::pair<size_t, size_t>;
+
+    /*!
+     * Regions of the statements of an ordinary parse, in order.
+     */
+    std::vector<Region> statements(std::string_view text) {
+        auto session = std::make_shared<parser::ParseSession>();
+        auto tree = grammar::Toplevel().match(parser::PContext{session, text, 0, 0});
+        std::vector<Region> result;
+        std::vector<parser::TreePtr> pending;
+        if (tree) {
+            pending.push_back(tree);
+        }
+        while (!pending.empty()) {
+            auto node = pending.back();
+            pending.pop_back();
+            if (node->rule == parser::rule_id<grammar::Stmt>()) {
+                result.emplace_back(node->parsed_region.data() - text.data(), node->parsed_region.size());
+                continue;
+            }
+            for (auto i = node->subtrees().size(); i-- > 0;) {
+                pending.push_back(node->subtrees()[i]);
+            }
+        }
+        return result;
+    }
+}
+
+int main() {
+    bench::GeneratorOptions options;
+    options.statements = 2000;
+    auto text = bench::Generator(options).program();
+    auto expected = statements(text);
+    if (expected.size() != options.statements) {
+        std::cerr << "FAILED: ordinary parse" << std::endl;
+        return 1;
+    }
+
+    // every statement is handed over once, in order, with the region an ordinary parse gives it
+    std::vector<Region> streamed;
+    auto matched = parser::stream<grammar::Toplevel>(text, [&](parser::TreePtr tree) {
+        expect(tree->rule == parser::rule_id<grammar::Stmt>(), "callback rule");
+        streamed.emplace_back(tree->parsed_region.data() - text.data(), tree->parsed_region.size());
+    });
+    expect(matched, "stream: match");
+    expect(streamed == expected, "stream: regions");
+
+    // a malformed statement fails the whole parse, after the statements before it were handed over
+    auto broken = text;
+    auto middle = expected[expected.size() / 2];
+    broken.insert(middle.first + middle.second - 1, ":=");
+    size_t calls = 0;
+    expect(!parser::stream<grammar::Toplevel>(broken, [&](parser::TreePtr) { calls++; }), "broken: match");
+    expect(calls >= expected.size() / 2 - 1 && calls < expected.size(), "broken: callbacks");
+
+    // the same through a mapped file
+    char path[] = "/tmp/stream-test-XXXXXX";
+    int fd = ::mkstemp(path);
+    expect(fd >= 0, "file: create");
+    if (fd >= 0) {
+        ::close(fd);
+        std::ofstream(path, std::ios::binary) << text;
+        std::vector<std::string> contents;
+        expect(parser::stream_file<grammar::Toplevel>(path, [&](parser::TreePtr tree) {
+            contents.emplace_back(tree->parsed_region);
+        }), "file: match");
+        expect(contents.size() == expected.size(), "file: callbacks");
+        for (size_t i = 0; i < std::min(contents.size(), expected.size()); ++i) {
+            expect(contents[i] == text.substr(expected[i].first, expected[i].second),
+                   "file: statement " + std::to_string(i));
+        }
+        std::ofstream(path, std::ios::binary) << broken;
+        expect(!parser::stream_file<grammar::Toplevel>(path, [](parser::TreePtr) {}), "file: broken");
+        std::remove(path);
+    }
+    expect(!parser::stream_file<grammar::Toplevel>("/nonexistent/stream", [](parser::TreePtr) {}), "file: missing");
+    return failures != 0;
+}